@@ -122,30 +122,55 @@
 
 /*********** Parameters controlling dense memory version of heap ***********/
 /*
- * Maximum heap size in bytes
+ * Default maximum heap size in bytes; mdriver -M changes it at run time
  */
 #define MAX_DENSE_HEAP (100*(1<<20))  /* 100 MB */
 
+/*
+ * The heap's address space is reserved up front, and committed in
+ * pieces of this many bytes as it grows
+ */
+#define MEM_COMMIT_STEP (1<<20)  /* 1 MB */
+
+/*
+ * Size of a huge page.  Heaps backed by huge pages start on, and commit
+ * in multiples of, this boundary.
+ */
+#define HUGE_PAGE_SIZE (1<<21)  /* 2 MB */
+
 /*
  * Starting address of the memory allocated for the heap by mmap
  */
 #define TRY_DENSE_HEAP_START (void *) 0x800000000
 
+/*
+ * Fixed address at which a heap backed by a file is mapped, so that the
+ * pointers stored in it are still good when a later process maps it again
+ */
+#define FILE_HEAP_START (void *) 0x500000000000UL
+
+/*
+ * Bytes each thread reserves at a time for mem_sbrk_local
+ */
+#define MEM_LOCAL_CHUNK (1<<17)  /* 128 KB */
+
 
 /*********** Parameters controlling sparse memory version of heap ***********/
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes.  memlib reserves the largest power-of-two
+ * fraction of this that the address space allows.
  */
 #define MAX_SPARSE_HEAP (1UL<<62)  /* 1 EB */
 
 /*
- * Initial address of emulated heap
+ * Suggested starting address of the emulated heap
  */
-#define SPARSE_HEAP_START (void *) 0x2130051300000000UL
+#define SPARSE_HEAP_START (void *) 0x213005130000UL
 
 /*
- * Number of bytes in each page
+ * Minimum number of bytes in each page; memlib rounds up to the
+ * system page size
  */
 #define SPARSE_PAGE_SIZE (1<<10)
 
@@ -154,4 +179,9 @@
  */
 #define HASH_LOAD 10.0
 
+/*
+ * Most pages the emulated heap can have materialized at once
+ */
+#define MAX_SPARSE_PAGES (1<<24)
+
 #endif /* __CONFIG_H */
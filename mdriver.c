@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,15 +19,22 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdbool.h>
 #include <math.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
 #include "config.h"
 #include "stree.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -41,6 +49,14 @@
 #define REF_ONLY 0
 #endif
 
+/* Cache model for the locality benchmark: an L1-like set-associative cache */
+#define CACHE_LINE    64          /* bytes per cache line */
+#define CACHE_SETS    64          /* number of sets */
+#define CACHE_WAYS     8          /* lines per set */
+#define WALK_BYTES   256          /* bytes of each live object touched per walk */
+#define WALK_SNAPSHOTS 16         /* number of times the live objects are walked */
+#define WALK_RECENT  1024         /* recent small allocations kept for the walks */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -79,13 +95,6 @@ typedef struct {
     tree_t *lo_tree;
 } range_set_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    long index;                         /* index for free() to use later */
-    size_t size;                        /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file */
 typedef struct {
     char filename[MAXLINE];
@@ -94,11 +103,112 @@ typedef struct {
     int num_ops;          /* number of distinct requests */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
+    size_t ops_mapped;    /* bytes mapped from a binary trace, 0 if read from text */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
 } trace_t;
 
+/*
+ * Streaming replay (-S): a reader thread fills one chunk of requests
+ * while the driver replays the other. The reader gives each live id a
+ * slot, reusing the slots of freed ids, and the ops it hands over carry
+ * slots instead of ids, so the driver's block tables need only as many
+ * entries as there are ids live at once.
+ */
+#define STREAM_CHUNK_OPS (1 << 16)  /* Requests per chunk */
+
+typedef struct {
+    traceop_t *ops;       /* requests, indexed by slot */
+    int num_ops;          /* number of requests in ops */
+    int num_slots;        /* slots handed out by the end of this chunk */
+    bool last;            /* no chunks follow this one */
+    bool failed;          /* the trace is bad after ops; see stream error */
+} chunk_t;
+
+/* Maps the ids of live blocks to their slots, by linear probing */
+typedef struct {
+    int64_t *ids;         /* id in each entry, -1 if the entry is empty */
+    int *slots;           /* slot of that id */
+    size_t mask;          /* number of entries - 1, a power of 2 minus 1 */
+    size_t used;          /* entries in use */
+} slot_map_t;
+
+typedef struct {
+    FILE *file;
+    bool binary;          /* file is a binary trace, not text */
+    uint64_t num_ops;     /* requests the header promises */
+    uint64_t ops_read;    /* requests read so far */
+    long line;            /* text lines read so far */
+    chunk_t chunk[2];
+    int current;          /* chunk the driver is replaying, -1 before the first */
+    sem_t filled[2];      /* posted when a chunk is ready to replay */
+    sem_t emptied[2];     /* posted when a chunk is ready to refill */
+    volatile bool stop;   /* tells the reader to quit early */
+    pthread_t reader;
+    slot_map_t map;       /* owned by the reader, like the fields below */
+    int *free_slots;      /* stack of slots freed ids left */
+    int num_free;
+    int max_free;
+    int num_slots;        /* slots handed out: the most ids live at once */
+    char error[MAXLINE];  /* what's wrong with the trace, if a chunk failed */
+} stream_t;
+
+/*
+ * Concurrent replay (-R): each thread of a trace replays its own requests
+ * on a thread of its own. A request waits for another thread only if
+ * that thread made the request before it on the same id: the earlier one
+ * posts how many requests on the id are done, and the later one waits
+ * for the count to reach its place among them. Every other pair of
+ * requests runs in whatever order the threads reach them.
+ */
+#define MAX_REPLAY_THREADS 32     /* Threads a trace can have under -R */
+#define REPLAY_RUNS 3             /* Runs of the replay; the fastest counts */
+
+typedef struct {
+    int *ops;             /* this thread's requests, as indices into trace ops */
+    int num_ops;
+    double busy;          /* secs in requests, not waiting on other threads */
+    struct replay *replay;
+    pthread_t thread;
+} replay_thread_t;
+
+typedef struct replay {
+    trace_t *trace;
+    int num_threads;
+    replay_thread_t threads[MAX_REPLAY_THREADS];
+    int *wait;            /* per request, count its id must reach first, or -1 */
+    int *post;            /* per request, count to post for its id after, or -1 */
+    int *done;            /* per id, requests on it done as far as posted */
+    int num_waits;        /* requests with a count to wait for */
+    bool libc;            /* replay with libc malloc rather than mm */
+    bool locked;          /* serialize mm calls through replay_mutex */
+    bool go;              /* holds the threads until all are started */
+} replay_t;
+
+/*
+ * Latency replay (-P): each request is timed alone with the cycle
+ * counter, into a log-linear histogram per request type. Below
+ * 2 * HIST_SUB cycles a bucket holds one value; above, each power of 2
+ * is split into HIST_SUB buckets, so a percentile read off the
+ * histogram is within 1/HIST_SUB of the true one, as in HDR histograms.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)          /* Buckets per power of 2 */
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+#define LATENCY_WORST 5           /* Slowest requests reported by index */
+
+/* What the latency replay found for one trace; times are in ns */
+typedef struct {
+    double count[3];      /* requests of each type, indexed by ALLOC etc. */
+    double p50[3];
+    double p99[3];
+    double p999[3];
+    double max[3];
+    int worst_op[LATENCY_WORST];   /* slowest requests, -1 if none */
+    double worst_ns[LATENCY_WORST];
+} latency_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -124,9 +234,68 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
 
+    /* set by the locality benchmark (-C) */
+    double miss_plain;   /* miss rate walking recent objects, coloring off */
+    double miss_colored; /* miss rate walking recent objects, coloring on */
+
+    /* set by the huge-page comparison (-H) */
+    double util_huge;    /* space utilization with huge pages */
+    double tput_huge;    /* throughput with huge pages in Kops/s */
+    mem_pages_t pages_huge; /* kind of huge pages the heap got */
+
+    /* set by the concurrent replay (-R) */
+    int threads;         /* threads in the trace */
+    int waits;           /* requests that wait for another thread's */
+    bool replay_locked;  /* mm calls were serialized by one lock */
+    double tput_replay;  /* mm throughput with all threads at once in Kops/s */
+    double tput_replay_libc; /* the same for libc */
+    double thread_ops[MAX_REPLAY_THREADS];     /* requests of each thread */
+    double thread_ns[MAX_REPLAY_THREADS];      /* mm ns per request */
+    double thread_ns_libc[MAX_REPLAY_THREADS]; /* libc ns per request */
+
+    /* set by the latency replay (-P) */
+    latency_t latency;
+
+    /* set after the utilization run, when the heap is at its largest */
+    size_t committed;    /* heap bytes committed by memlib */
+    size_t resident;     /* heap bytes actually in memory */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* State of the simulated cache used by the locality benchmark */
+typedef struct {
+    unsigned long tag[CACHE_SETS][CACHE_WAYS];
+    unsigned long used[CACHE_SETS][CACHE_WAYS]; /* time of last use; 0 if empty */
+    unsigned long clock;
+    double accesses;
+    double misses;
+} cache_sim_t;
+
+/* The most recent allocations of at most WALK_BYTES, which the locality
+   benchmark walks as a working set the size of the cache */
+typedef struct {
+    int index[WALK_RECENT];
+    char *block[WALK_RECENT];   /* NULL if the slot is unused */
+    int next;                   /* slot of the next allocation */
+} walk_set_t;
+
+/*
+ * A producer/consumer pair of the pipeline benchmark: the producer
+ * allocates blocks and passes them through a ring to the consumer,
+ * which checks and frees them
+ */
+#define PIPE_SLOTS 1024          /* Blocks in flight per pair */
+#define PIPE_OPS   (1 << 20)     /* Blocks each producer passes on */
+
+typedef struct {
+    unsigned char *slot[PIPE_SLOTS];
+    size_t head;                 /* Next slot the producer fills */
+    size_t tail;                 /* Next slot the consumer empties */
+    bool failed;                 /* The consumer found a damaged block */
+    pthread_t producer, consumer;
+} pipe_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -162,6 +331,16 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool locality_mode = false; /* Run the locality benchmark (-C) */
+static bool huge_mode = false;     /* Rerun each trace with huge pages (-H) */
+static size_t heap_limit = 0;      /* Cap on the heap size (-L), 0 for none */
+static int pipeline_pairs = 0;     /* Producer/consumer pairs to run (-Q) */
+static int num_jobs = 1;           /* Traces evaluated at once (-j) */
+static bool serial_timing = false; /* With -j, time traces one at a time (-J) */
+static char *heap_file = NULL;     /* File to keep the heap in (-F), NULL for none */
+static bool stream_mode = false;   /* Stream each trace through one pass (-S) */
+static bool replay_mode = false;   /* Replay each trace's threads at once (-R) */
+static bool latency_mode = false;  /* Time each request alone (-P) */
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
 static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
@@ -185,6 +364,28 @@ static char **global_tracefiles = NULL;
 
 static char autoresult[MAXLINE]; /* autoresult string */
 
+/* Optional mm policies that can be switched on with -o <name> */
+typedef struct {
+    const char *name;
+    void (*enable)(bool enable);
+    bool enabled;
+} policy_t;
+
+static policy_t mm_policies[] = {
+    { "side-table", mm_set_side_table, false },
+    { "exact-cache", mm_set_exact_cache, false },
+    { "color", mm_set_coloring, false },
+    { "lifetime", mm_set_lifetime, false },
+    { "purge", mm_set_purging, false },
+    { "background", mm_set_background, false },
+    { "slab", mm_set_slab, false },
+    { "owned", mm_set_owned_heaps, false },
+    { "fine-locks", mm_set_fine_locks, false },
+    { "huge", mm_set_huge_align, false },
+    { "remap", mm_set_remap, false },
+    { NULL, NULL, false }
+};
+
 /* Summary statistics for libc and student's mm.c submissions */
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
@@ -203,6 +404,7 @@ static range_set_t *new_range_set();
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
                       const trace_t *trace, int opnum, int index);
 static void remove_range(range_set_t *ranges, char *lo);
+static void clear_range_set(range_set_t *ranges);
 static void free_range_set(range_set_t *ranges);
 
 /* These functions implement the debugging code */
@@ -213,9 +415,24 @@ static void randomize_block(trace_t *trace, int index);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static bool map_trace(trace_t *trace);
+static void parse_trace(trace_t *trace);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
+/* These functions stream a trace's requests in chunks (-S) */
+static stream_t *open_stream(trace_t *trace, stats_t *stats,
+                             const char *tracedir, const char *filename);
+static const chunk_t *next_chunk(stream_t *stream);
+static void close_stream(stream_t *stream);
+static void *stream_reader(void *arg);
+static void fill_chunk(stream_t *stream, chunk_t *chunk);
+static bool read_op(stream_t *stream, traceop_t *op, int64_t *id);
+static inline size_t slot_home(const slot_map_t *map, int64_t id);
+static int slot_find(slot_map_t *map, int64_t id);
+static void slot_insert(slot_map_t *map, int64_t id, int slot);
+static void slot_remove(slot_map_t *map, int64_t id);
+
 /* Routines for evaluating the correctness and speed of libc malloc */
 static bool eval_libc_valid(trace_t *trace);
 static void eval_libc_speed(void *ptr);
@@ -223,10 +440,60 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
+static bool reopen_heap(trace_t *trace, int opnum);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static double eval_mm_locality(trace_t *trace, bool color);
+static void eval_mm_huge(speed_t *speed_params, int tracenum, stats_t *stats);
+
+/* Producer/consumer benchmark for cross-thread frees */
+static void run_pipeline(int pairs);
+static bool run_trace(const char *tracedir, char *tracefile, int tracenum,
+                      stats_t *stats, speed_t *speed_params, bool timed);
+static bool stream_trace(const char *tracedir, char *tracefile,
+                         stats_t *stats);
+static bool eval_mm_stream(trace_t *trace, stream_t *stream,
+                           range_set_t *ranges, stats_t *stats);
+static void time_trace(int tracenum, stats_t *stats, speed_t *speed_params);
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles,
+                               stats_t *mm_stats, speed_t *speed_params);
+static double eval_mm_pipeline(int pairs, bool slab, bool owned);
+static void *pipe_producer(void *arg);
+static void *pipe_consumer(void *arg);
+
+/* Replay of each thread of a trace on a thread of its own (-R) */
+static void replay_trace(trace_t *trace, stats_t *stats);
+
+/* Replay that times each request into latency histograms (-P) */
+static void eval_latency(trace_t *trace, bool libc, latency_t *latency);
+static inline uint64_t read_cycles(void);
+static uint64_t cycle_overhead(void);
+static inline int hist_bucket(uint64_t cycles);
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count,
+                                double fraction);
+static replay_t *new_replay(trace_t *trace);
+static void free_replay(replay_t *replay);
+static double eval_replay(replay_t *replay, bool libc, double *thread_ns);
+static void *replay_thread(void *arg);
+
+/* Cache model for the locality benchmark */
+static void cache_reset(cache_sim_t *cache);
+static void cache_access(cache_sim_t *cache, unsigned long addr);
+static void walk_live_objects(trace_t *trace, cache_sim_t *cache,
+                              const walk_set_t *recent);
+static void walk_record(walk_set_t *recent, int index, char *block,
+                        size_t size);
 
 /* Various helper routines */
+static void enable_policy(const char *name);
+static bool policy_enabled(const char *name);
+static void printlocality(int n, stats_t *stats);
+static void printmemory(int n, stats_t *stats);
+static void printhuge(int n, stats_t *stats);
+static void printreplay(int n, stats_t *stats);
+static void printlatency(const char *name, int n, stats_t *stats);
+static void print_policy_stats(void);
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
@@ -254,59 +521,242 @@ long int random(void)
 #endif
 
 /*
- * Run the tests; return the number of tests run (may be less than
- * num_tracefiles, if there's a timeout)
+ * Run the tests, one trace after another, or in forked workers with -j
  */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles,
                       stats_t *mm_stats, speed_t *speed_params) {
-    volatile int i;
+    int i;
 
+    if (num_jobs > 1 && !onetime_flag) {
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           speed_params);
+        return;
+    }
     for (i=0; i < num_tracefiles; i++) {
-        /* initialize simulated memory system in memlib.c *
-         * start each trace with a clean system */
-        mem_init(sparse_mode);
-        range_set_t *ranges = new_range_set();
+        if (!run_trace(tracedir, tracefiles[i], i, &mm_stats[i],
+                       speed_params, true))
+            return;
+    }
+}
+
+/*
+ * run_trace - check, measure and, if timed is set, time one trace on a
+ *   heap of its own. Returns false if the run should stop after it.
+ */
+static bool run_trace(const char *tracedir, char *tracefile, int tracenum,
+                      stats_t *stats, speed_t *speed_params, bool timed) {
+    if (stream_mode)
+        return stream_trace(tracedir, tracefile, stats);
 
+    /* initialize simulated memory system in memlib.c *
+     * start each trace with a clean system */
+    mem_init(sparse_mode);
+    range_set_t *ranges = new_range_set();
 
-        // NOTE: If times out, then it will reread the trace file
 
-        trace_t *trace;
-        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+    // NOTE: If times out, then it will reread the trace file
 
-        /* Prepare for timeout */
-        if (setjmp(timeout_jmpbuf) != 0) {
-            mm_stats[i].valid = false;
-        } else {
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-                /* Do 2 tests, since may fail to reinitialize properly */
-                eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
-
-            if (onetime_flag) {
-                free_trace(trace);
-                return;
-            }
+    trace_t *trace;
+    trace = read_trace(stats, tracedir, tracefile);
+    strcpy(stats->filename, trace->filename);
+    stats->ops = trace->num_ops;
+
+    /* Prepare for timeout */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        stats->valid = false;
+    } else {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        stats->valid =
+            /* Do 2 tests, since may fail to reinitialize properly */
+            eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+
+        if (onetime_flag) {
+            free_trace(trace);
+            return false;
         }
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
+    }
+    if (stats->valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        stats->util = eval_mm_util(trace, tracenum);
+        stats->committed = mem_committed();
+        stats->resident = mem_resident();
+        if (verbose > 1)
+            print_policy_stats();
+        if (locality_mode) {
+            stats->miss_plain = eval_mm_locality(trace, false);
+            stats->miss_colored = eval_mm_locality(trace, true);
+            mm_set_coloring(policy_enabled("color"));
+        }
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (timed) {
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
-            mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+            time_trace(tracenum, stats, speed_params);
+        } else if (verbose > 1) {
+            printf("performance later.\n");
+        }
+    }
+
+    free_trace(trace);
+    free_range_set(ranges);
+
+    /* clean up memory system */
+    mm_stop_background();
+    mem_deinit();
+    return true;
+}
+
+/*
+ * stream_trace - run_trace for -S: check, measure and time the trace in
+ *   one pass, as a reader thread streams its requests from the file.
+ *   Returns false if the run should stop after it.
+ */
+static bool stream_trace(const char *tracedir, char *tracefile,
+                         stats_t *stats) {
+    trace_t *trace;
+    stream_t *stream;
+    range_set_t *ranges;
+
+    mem_init(sparse_mode);
+    ranges = new_range_set();
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+        unix_error("calloc failed in stream_trace");
+    stream = open_stream(trace, stats, tracedir, tracefile);
+
+    if (setjmp(timeout_jmpbuf) != 0) {
+        stats->valid = false;
+    } else {
+        if (verbose > 1)
+            printf("Checking, measuring and timing mm_malloc in one pass, ");
+        stats->valid = eval_mm_stream(trace, stream, ranges, stats);
+        if (stats->valid) {
+            stats->committed = mem_committed();
+            stats->resident = mem_resident();
+        }
+        if (verbose > 1)
+            printf("streamed %.0f ops with at most %d ids live.\n",
+                   stats->ops, stream->num_slots);
+    }
+
+    close_stream(stream);
+    free_trace(trace);
+    free_range_set(ranges);
+    mm_stop_background();
+    mem_deinit();
+    return !onetime_flag;
+}
+
+/*
+ * time_trace - time the trace in speed_params, with -R time its threads
+ *   replayed at once, with -P time each request, and with -H time it
+ *   again with huge pages
+ */
+static void time_trace(int tracenum, stats_t *stats, speed_t *speed_params) {
+    stats->secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
+    stats->tput = stats->ops / (stats->secs * 1000.0);
+    if (replay_mode && !sparse_mode)
+        replay_trace(speed_params->trace, stats);
+    if (latency_mode && !sparse_mode)
+        eval_latency(speed_params->trace, false, &stats->latency);
+    if (huge_mode && !sparse_mode)
+        eval_mm_huge(speed_params, tracenum, stats);
+}
+
+/*
+ * run_tests_parallel - run_tests for -j: each trace runs in a forked
+ *   worker, with a heap of its own, and up to num_jobs of them at once.
+ *   A worker sends its stats back over a pipe. With -J the workers leave
+ *   out the timing, and the traces are timed here afterwards one at a
+ *   time, so that no worker competes with the trace being timed.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles,
+                               stats_t *mm_stats, speed_t *speed_params) {
+    pid_t *workers = calloc(num_tracefiles, sizeof(pid_t));
+    int *results = calloc(num_tracefiles, sizeof(int));
+    int next = 0, running = 0;
+    int fds[2];
+    int status;
+    volatile int i;
+    pid_t pid;
+
+    if (workers == NULL || results == NULL)
+        unix_error("calloc in run_tests_parallel failed");
+
+    /* Workers time out one by one, each after set_timeout secs */
+    alarm(0);
+    while (next < num_tracefiles || running > 0) {
+        if (next < num_tracefiles && running < num_jobs) {
+            if (pipe(fds) != 0)
+                unix_error("pipe in run_tests_parallel failed");
+            if ((pid = fork()) < 0)
+                unix_error("fork in run_tests_parallel failed");
+            if (pid == 0) {
+                close(fds[0]);
+                if (set_timeout > 0)
+                    alarm(set_timeout);
+                run_trace(tracedir, tracefiles[next], next, &mm_stats[next],
+                          speed_params, !serial_timing);
+                /* Less than PIPE_BUF, so written whole or not at all */
+                if (write(fds[1], &mm_stats[next], sizeof(stats_t))
+                    != sizeof(stats_t))
+                    _exit(2);
+                _exit(errors ? 1 : 0);
+            }
+            close(fds[1]);
+            workers[next] = pid;
+            results[next] = fds[0];
+            next++;
+            running++;
+            continue;
+        }
+
+        if ((pid = wait(&status)) < 0)
+            unix_error("wait in run_tests_parallel failed");
+        for (i = 0; i < next && workers[i] != pid; i++)
+            ;
+        if (i == next)
+            continue;
+        running--;
+        if (read(results[i], &mm_stats[i], sizeof(stats_t)) != sizeof(stats_t)) {
+            fprintf(stderr, "ERROR: worker for %s died without results\n",
+                    tracefiles[i]);
+            memset(&mm_stats[i], 0, sizeof(stats_t));
+            snprintf(mm_stats[i].filename, MAXLINE, "%s", tracefiles[i]);
+            errors = 1;
         }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            errors = 1;
+        close(results[i]);
+    }
+    free(workers);
+    free(results);
 
+    if (!serial_timing)
+        return;
+    if (set_timeout > 0)
+        alarm(set_timeout);
+    for (i = 0; i < num_tracefiles; i++) {
+        if (!mm_stats[i].valid)
+            continue;
+        if (verbose > 1)
+            printf("Timing %s\n", mm_stats[i].filename);
+        mem_init(sparse_mode);
+        range_set_t *ranges = new_range_set();
+        trace_t *trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (setjmp(timeout_jmpbuf) != 0)
+            mm_stats[i].valid = false;
+        else
+            time_trace(i, &mm_stats[i], speed_params);
         free_trace(trace);
         free_range_set(ranges);
-
-        /* clean up memory system */
+        mm_stop_background();
         mem_deinit();
     }
 }
@@ -348,7 +798,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:j:o:s:t:v:F:L:M:Q:hpOVAlCDHJPRST")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -397,6 +847,10 @@ int main(int argc, char **argv)
             debug_mode = DBG_EXPENSIVE;
             break;
 
+        case 'o': /* Enable an optional mm policy */
+            enable_policy(optarg);
+            break;
+
         case 's':
             set_timeout = atoi(optarg);
             break;
@@ -405,6 +859,77 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'C': /* Compare locality of live objects with and without coloring */
+            locality_mode = true;
+            break;
+
+        case 'H': /* Compare throughput with and without huge pages */
+            huge_mode = true;
+            break;
+
+        case 'L': { /* Cap the heap, with mm's soft limit 1/8 below the cap */
+            char *end;
+            heap_limit = strtoul(optarg, &end, 0);
+            if (*end == 'K' || *end == 'k')
+                heap_limit <<= 10;
+            else if (*end == 'M' || *end == 'm')
+                heap_limit <<= 20;
+            mem_set_limit(heap_limit);
+            mm_set_soft_limit(heap_limit - heap_limit / 8);
+            break;
+        }
+
+        case 'M': { /* Reserve n bytes of address space for the heap */
+            char *end;
+            size_t max_heap = strtoul(optarg, &end, 0);
+            if (*end == 'K' || *end == 'k')
+                max_heap <<= 10;
+            else if (*end == 'M' || *end == 'm')
+                max_heap <<= 20;
+            else if (*end == 'G' || *end == 'g')
+                max_heap <<= 30;
+            if (max_heap == 0)
+                app_error("-M needs a heap size above 0");
+            mem_set_max_heap(max_heap);
+            break;
+        }
+
+        case 'j': /* Evaluate up to n traces at once in worker processes */
+            num_jobs = atoi(optarg);
+            if (num_jobs < 1)
+                app_error("-j needs at least one job");
+            break;
+
+        case 'J': /* With -j, time the traces one at a time */
+            serial_timing = true;
+            break;
+
+        case 'P': /* Report percentiles of each request type's latency */
+            latency_mode = true;
+            break;
+
+        case 'R': /* Replay each trace's threads concurrently, mm and libc */
+            replay_mode = true;
+            break;
+
+        case 'S': /* Stream each trace from its file through one pass */
+            stream_mode = true;
+            break;
+
+        case 'F': /* Keep the heap in a file, and reopen it mid-trace */
+            if (sparse_mode)
+                app_error("-F needs a dense heap");
+            heap_file = optarg;
+            mem_set_file(heap_file);
+            mm_set_persistent(true);
+            break;
+
+        case 'Q': /* Run the producer/consumer benchmark instead */
+            pipeline_pairs = atoi(optarg);
+            if (pipeline_pairs < 1)
+                app_error("-Q needs at least one producer/consumer pair");
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -416,6 +941,18 @@ int main(int argc, char **argv)
     }
 #endif /* !REF_ONLY */
 
+    if (heap_file != NULL && num_jobs > 1)
+        app_error("-F and -j can't be used together: the workers would share the file");
+    if (stream_mode && (heap_file != NULL || serial_timing || run_libc
+                        || locality_mode || huge_mode || replay_mode
+                        || latency_mode))
+        app_error("-S can't be used with -F, -J, -l, -C, -H, -P or -R: they need the whole trace");
+
+    if (pipeline_pairs > 0) {
+        run_pipeline(pipeline_pairs);
+        exit(errors ? 1 : 0);
+    }
+
     if (num_global_tracefiles == 0) {
         int i;
         for (i = 0; default_tracefiles[i]; i++)
@@ -456,6 +993,8 @@ int main(int argc, char **argv)
                 if (verbose > 1)
                     printf("and performance.\n");
                 libc_stats[i].secs = fsec(eval_libc_speed, &speed_params);
+                if (latency_mode)
+                    eval_latency(trace, true, &libc_stats[i].latency);
             }
             free_trace(trace);
         }
@@ -497,6 +1036,30 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (locality_mode) {
+                printlocality(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (huge_mode && !sparse_mode) {
+                printhuge(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (replay_mode && !sparse_mode) {
+                printreplay(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (latency_mode && !sparse_mode) {
+                printlatency("mm", num_global_tracefiles, mm_stats);
+                printf("\n");
+                if (run_libc) {
+                    printlatency("libc", num_global_tracefiles, libc_stats);
+                    printf("\n");
+                }
+            }
+            if (verbose > 1) {
+                printmemory(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -766,6 +1329,18 @@ static void remove_range(range_set_t *ranges, char *lo)
     free(p);
 }
 
+/*
+ * clear_range_set - free all of the range records, leaving the set
+ *   empty for another run of the trace. Captured traces can end with
+ *   blocks still allocated.
+ */
+static void clear_range_set(range_set_t *ranges)
+{
+    tree_free(ranges->lo_tree, free);
+    ranges->lo_tree = tree_new();
+    ranges->list = NULL;
+}
+
 /*
  * free_range_set - free all of the range records for a trace
  */
@@ -870,14 +1445,7 @@ static bool check_index(const trace_t *trace, int opnum, int index) {
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index;
-    size_t size;
-    int max_index = 0;
-    int op_index;
-    int ignore = 0;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -886,9 +1454,51 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* Read the header and the requests, straight from a binary trace */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
+    if (!map_trace(trace))
+        parse_trace(trace);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+
+    return trace;
+}
+
+/*
+ * parse_trace - read the header and requests of the text trace
+ *   trace->filename into trace
+ */
+static void parse_trace(trace_t *trace)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    char *request;
+    int index;
+    long thread;
+    size_t size;
+    int max_index = 0;
+    int op_index;
+    int ignore = 0;
+
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
@@ -907,28 +1517,23 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
+    trace->ops_mapped = 0;
 
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
+        /* A request made by a thread other than 0 starts "<thread>:" */
+        thread = strtol(type, &request, 10);
+        if (request != type) {
+            if (*request++ != ':' || thread < 0 || thread > TRACE_MAX_THREAD)
+                app_error("Bad thread id (%s) in tracefile %s\n",
+                          type, trace->filename);
+            if (*request == '\0' && fscanf(tracefile, "%s", type) == 1)
+                request = type;
+        }
+        trace->ops[op_index].thread = thread;
+        switch(request[0]) {
         case 'a':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
             trace->ops[op_index].type = ALLOC;
@@ -950,7 +1555,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
+                      request[0], trace->filename);
         }
         op_index++;
         if (op_index == trace->num_ops) break;
@@ -958,13 +1563,65 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
 
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+/*
+ * map_trace - if trace->filename is a binary trace, map its operations
+ *   into trace->ops, check its requests, fill in the header fields and
+ *   return true. Returns false, having mapped nothing, if it's a text
+ *   trace.
+ */
+static bool map_trace(trace_t *trace)
+{
+    trace_header_t header;
+    struct stat st;
+    void *base;
+    int fd, i;
 
-    return trace;
+    if ((fd = open(trace->filename, O_RDONLY)) < 0)
+        unix_error("Could not open %s in read_trace", trace->filename);
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        close(fd);
+        return false;
+    }
+    if (fstat(fd, &st) != 0)
+        unix_error("Could not stat %s in read_trace", trace->filename);
+    if (header.version < 1 || header.version > TRACE_VERSION)
+        app_error("%s: binary trace version %u, not 1 to %d",
+                  trace->filename, header.version, TRACE_VERSION);
+    if (header.weight > 3)
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    if (header.num_ids > INT32_MAX || header.num_ops > INT32_MAX
+        || (uint64_t) st.st_size
+           != sizeof(header) + header.num_ops * sizeof(traceop_t))
+        app_error("%s: binary trace is truncated or too large",
+                  trace->filename);
+
+    trace->ops_mapped = st.st_size;
+    base = mmap(NULL, trace->ops_mapped, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        unix_error("Could not map %s in read_trace", trace->filename);
+    close(fd);
+
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->data_bytes = header.data_bytes;
+    trace->ops = (traceop_t *)((char *) base + sizeof(header));
+
+    /* The replay indexes the block tables with each id, so check them */
+    for (i = 0; i < trace->num_ops; i++) {
+        const traceop_t *op = &trace->ops[i];
+        if (op->type > REALLOC)
+            app_error("%s: request %d has bad type %u\n", trace->filename, i,
+                      op->type);
+        if (op->index < -1 || op->index >= trace->num_ids
+            || (op->index == -1 && op->type != FREE))
+            app_error("%s: request %d has bad id %d\n", trace->filename, i,
+                      op->index);
+    }
+    return true;
 }
 
 /*
@@ -983,46 +1640,435 @@ static void reinit_trace(trace_t *trace)
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->ops_mapped > 0) /* free the three arrays... */
+        munmap((char *) trace->ops - sizeof(trace_header_t), trace->ops_mapped);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
     free(trace);              /* and the trace record itself... */
 }
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+/**********************************************
+ * The following routines stream a trace's requests from its file,
+ * for traces too large to read in whole (-S)
+ *********************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * open_stream - open a text or binary trace, fill in trace and stats
+ *   from its header, and start the reader thread on its requests. The
+ *   block tables of trace start out empty; eval_mm_stream grows them.
  */
-static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
+static stream_t *open_stream(trace_t *trace, stats_t *stats,
+                             const char *tracedir, const char *filename)
 {
+    stream_t *stream;
+    trace_header_t header;
+    long long fields[4];
+    sigset_t alarm_set, old_set;
     int i;
-    int index;
-    size_t size;
-    char *newp;
-    char *oldp;
-    char *p;
-    bool allCheck = true;
-
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
-    reinit_trace(trace);
 
-    /* Call the mm package's init function */
-    if (!mm_init()) {
-        malloc_error(trace, 0, "mm_init failed.");
-        return false;
+    if (verbose > 1)
+        printf("Streaming tracefile: %s\n", filename);
+    if ((stream = (stream_t *) calloc(1, sizeof(stream_t))) == NULL)
+        unix_error("calloc failed in open_stream");
+    strcpy(trace->filename, tracedir);
+    strcat(trace->filename, filename);
+    if ((stream->file = fopen(trace->filename, "r")) == NULL)
+        unix_error("Could not open %s in open_stream", trace->filename);
+
+    /* Read the header, straight from a binary trace... */
+    if (fread(&header, sizeof(header), 1, stream->file) == 1
+        && memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0) {
+        if (header.version < 1 || header.version > TRACE_VERSION)
+            app_error("%s: binary trace version %u, not 1 to %d",
+                      trace->filename, header.version, TRACE_VERSION);
+        stream->binary = true;
+        fields[0] = header.weight;
+        fields[1] = header.num_ids;
+        fields[2] = header.num_ops;
+        fields[3] = header.data_bytes;
+    } else { /* ... or from the first lines of a text trace */
+        rewind(stream->file);
+        for (i = 0; i < HDRLINES; i++)
+            if (fscanf(stream->file, "%lld", &fields[i]) != 1 || fields[i] < 0)
+                app_error("%s: bad header line %d", trace->filename, i + 1);
+        stream->line = HDRLINES;
+    }
+    if (fields[0] > 3)
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    stream->num_ops = fields[2];
+
+    /* trace holds no requests, and a block table entry for each slot */
+    trace->weight = fields[0];
+    trace->num_ids = 0;
+    trace->num_ops = fields[2] > INT_MAX ? INT_MAX : fields[2];
+    trace->data_bytes = fields[3];
+    trace->ops = NULL;
+    trace->ops_mapped = 0;
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = 0;
+
+    stream->current = -1;
+    stream->map.mask = 1023;
+    stream->map.ids = malloc((stream->map.mask + 1) * sizeof(int64_t));
+    stream->map.slots = malloc((stream->map.mask + 1) * sizeof(int));
+    if (stream->map.ids == NULL || stream->map.slots == NULL)
+        unix_error("malloc failed in open_stream");
+    memset(stream->map.ids, -1, (stream->map.mask + 1) * sizeof(int64_t));
+    for (i = 0; i < 2; i++) {
+        stream->chunk[i].ops = malloc(STREAM_CHUNK_OPS * sizeof(traceop_t));
+        if (stream->chunk[i].ops == NULL)
+            unix_error("malloc failed in open_stream");
+        sem_init(&stream->filled[i], 0, 0);
+        sem_init(&stream->emptied[i], 0, 1);
     }
 
-    /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
+    /* Leave the timeout alarm to the thread it longjmps in */
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm_set, &old_set);
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream) != 0)
+        unix_error("pthread_create failed in open_stream");
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return stream;
+}
+
+/*
+ * next_chunk - hand the chunk just replayed back to the reader, and wait
+ *   for it to fill the other one
+ */
+static const chunk_t *next_chunk(stream_t *stream)
+{
+    int k = 0;
+
+    if (stream->current >= 0) {
+        sem_post(&stream->emptied[stream->current]);
+        k = stream->current ^ 1;
+    }
+    while (sem_wait(&stream->filled[k]) != 0)
+        ;
+    stream->current = k;
+    return &stream->chunk[k];
+}
+
+/*
+ * close_stream - stop the reader, wherever it is in the trace, and free
+ *   the stream
+ */
+static void close_stream(stream_t *stream)
+{
+    int i;
+
+    stream->stop = true;
+    sem_post(&stream->emptied[0]);
+    sem_post(&stream->emptied[1]);
+    pthread_join(stream->reader, NULL);
+    fclose(stream->file);
+    for (i = 0; i < 2; i++) {
+        free(stream->chunk[i].ops);
+        sem_destroy(&stream->filled[i]);
+        sem_destroy(&stream->emptied[i]);
+    }
+    free(stream->map.ids);
+    free(stream->map.slots);
+    free(stream->free_slots);
+    free(stream);
+}
+
+/*
+ * stream_reader - the reader thread: fill the two chunks in turn, each
+ *   once the driver has handed it back, until the trace ends
+ */
+static void *stream_reader(void *arg)
+{
+    stream_t *stream = arg;
+    chunk_t *chunk;
+    int k = 0;
+
+    for (;;) {
+        while (sem_wait(&stream->emptied[k]) != 0)
+            ;
+        if (stream->stop)
+            break;
+        chunk = &stream->chunk[k];
+        fill_chunk(stream, chunk);
+        sem_post(&stream->filled[k]);
+        if (chunk->last)
+            break;
+        k ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * fill_chunk - read the next requests of the trace into chunk, with the
+ *   ids of their blocks turned into slots. A block's slot is taken when
+ *   its id is first allocated and given back when the id is freed.
+ */
+static void fill_chunk(stream_t *stream, chunk_t *chunk)
+{
+    traceop_t *op;
+    int64_t id;
+    int slot;
+
+    chunk->num_ops = 0;
+    chunk->failed = false;
+    while (chunk->num_ops < STREAM_CHUNK_OPS
+           && stream->ops_read < stream->num_ops) {
+        op = &chunk->ops[chunk->num_ops];
+        if (!read_op(stream, op, &id)) {
+            chunk->failed = true;
+            break;
+        }
+        slot = id < 0 ? -1 : slot_find(&stream->map, id);
+        switch (op->type) {
+        case ALLOC:
+            if (slot >= 0) {
+                snprintf(stream->error, MAXLINE,
+                         "id %lld allocated again while live", (long long) id);
+                chunk->failed = true;
+                break;
+            }
+            /* fall through */
+        case REALLOC: /* of a null pointer, if the id isn't live */
+            if (slot < 0) {
+                slot = stream->num_free > 0
+                    ? stream->free_slots[--stream->num_free]
+                    : stream->num_slots++;
+                slot_insert(&stream->map, id, slot);
+            }
+            break;
+        case FREE:
+            if (id >= 0 && slot < 0) {
+                snprintf(stream->error, MAXLINE,
+                         "id %lld freed while not live", (long long) id);
+                chunk->failed = true;
+                break;
+            }
+            if (slot < 0)
+                break;
+            slot_remove(&stream->map, id);
+            if (stream->num_free == stream->max_free) {
+                stream->max_free = stream->max_free ? 2 * stream->max_free : 1024;
+                stream->free_slots = realloc(stream->free_slots,
+                                             stream->max_free * sizeof(int));
+                if (stream->free_slots == NULL)
+                    unix_error("realloc failed in fill_chunk");
+            }
+            stream->free_slots[stream->num_free++] = slot;
+            break;
+        }
+        if (chunk->failed)
+            break;
+        op->index = slot;
+        chunk->num_ops++;
+        stream->ops_read++;
+    }
+    chunk->num_slots = stream->num_slots;
+    chunk->last = chunk->failed || stream->ops_read == stream->num_ops;
+}
+
+/*
+ * read_op - read the next request of the trace into op, and the id of
+ *   its block into id. Returns false, with stream->error set, if the
+ *   request is missing or malformed.
+ */
+static bool read_op(stream_t *stream, traceop_t *op, int64_t *id)
+{
+    char line[MAXLINE];
+    char *pos, *end;
+
+    if (stream->binary) {
+        if (fread(op, sizeof(*op), 1, stream->file) != 1) {
+            snprintf(stream->error, MAXLINE, "binary trace is truncated");
+            return false;
+        }
+        if (op->type > REALLOC || (op->index < 0 && op->type != FREE)) {
+            snprintf(stream->error, MAXLINE, "bad binary request");
+            return false;
+        }
+        *id = op->index;
+        return true;
+    }
+
+    do {
+        if (fgets(line, sizeof(line), stream->file) == NULL) {
+            snprintf(stream->error, MAXLINE, "trace ends after %llu requests",
+                     (unsigned long long) stream->ops_read);
+            return false;
+        }
+        stream->line++;
+        pos = line + strspn(line, " \t\r\n");
+    } while (*pos == '\0');
+
+    /* The driver replays a stream in order, whatever the thread */
+    op->thread = 0;
+    if (*pos >= '0' && *pos <= '9') {
+        unsigned long thread = strtoul(pos, &end, 10);
+        if (*end != ':' || thread > TRACE_MAX_THREAD) {
+            snprintf(stream->error, MAXLINE, "bad thread id on line %ld",
+                     stream->line);
+            return false;
+        }
+        op->thread = thread;
+        pos = end + 1 + strspn(end + 1, " \t");
+    }
+
+    switch (*pos++) {
+    case 'a':
+        op->type = ALLOC;
+        break;
+    case 'r':
+        op->type = REALLOC;
+        break;
+    case 'f':
+        op->type = FREE;
+        break;
+    default:
+        snprintf(stream->error, MAXLINE, "bogus request on line %ld",
+                 stream->line);
+        return false;
+    }
+    *id = strtoll(pos, &end, 10);
+    op->size = 0;
+    if (end == pos || *id < -1 || (*id < 0 && op->type != FREE)) {
+        snprintf(stream->error, MAXLINE, "bad id on line %ld", stream->line);
+        return false;
+    }
+    if (op->type != FREE) {
+        pos = end;
+        op->size = strtoull(pos, &end, 10);
+        if (end == pos) {
+            snprintf(stream->error, MAXLINE, "bad size on line %ld",
+                     stream->line);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * slot_home - the entry where the search for id starts
+ */
+static inline size_t slot_home(const slot_map_t *map, int64_t id)
+{
+    return ((uint64_t) id * 0x9e3779b97f4a7c15UL >> 20) & map->mask;
+}
+
+/*
+ * slot_find - the slot of live id, or -1 if it isn't live
+ */
+static int slot_find(slot_map_t *map, int64_t id)
+{
+    size_t i = slot_home(map, id);
+
+    for (; map->ids[i] != -1; i = (i + 1) & map->mask)
+        if (map->ids[i] == id)
+            return map->slots[i];
+    return -1;
+}
+
+/*
+ * slot_insert - give id, which isn't live, the slot slot, doubling the
+ *   map once it's half full
+ */
+static void slot_insert(slot_map_t *map, int64_t id, int slot)
+{
+    size_t i, j, old_size = map->mask + 1;
+    int64_t *old_ids;
+    int *old_slots;
+
+    if (2 * (map->used + 1) > old_size) {
+        old_ids = map->ids;
+        old_slots = map->slots;
+        map->mask = 2 * old_size - 1;
+        map->ids = malloc(2 * old_size * sizeof(int64_t));
+        map->slots = malloc(2 * old_size * sizeof(int));
+        if (map->ids == NULL || map->slots == NULL)
+            unix_error("malloc failed in slot_insert");
+        memset(map->ids, -1, 2 * old_size * sizeof(int64_t));
+        map->used = 0;
+        for (j = 0; j < old_size; j++)
+            if (old_ids[j] != -1)
+                slot_insert(map, old_ids[j], old_slots[j]);
+        free(old_ids);
+        free(old_slots);
+    }
+    i = slot_home(map, id);
+    while (map->ids[i] != -1)
+        i = (i + 1) & map->mask;
+    map->ids[i] = id;
+    map->slots[i] = slot;
+    map->used++;
+}
+
+/*
+ * slot_remove - forget live id, moving back any entries after it that
+ *   would no longer be found past the hole
+ */
+static void slot_remove(slot_map_t *map, int64_t id)
+{
+    size_t i, j, home;
+
+    i = slot_home(map, id);
+    while (map->ids[i] != id)
+        i = (i + 1) & map->mask;
+    for (j = (i + 1) & map->mask; map->ids[j] != -1; j = (j + 1) & map->mask) {
+        home = slot_home(map, map->ids[j]);
+        /* Move the entry at j to the hole at i, if i lies from home to j */
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->ids[i] = map->ids[j];
+            map->slots[i] = map->slots[j];
+            i = j;
+        }
+    }
+    map->ids[i] = -1;
+    map->used--;
+}
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness
+ */
+static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
+{
+    int i;
+    int index;
+    size_t size;
+    char *newp;
+    char *oldp;
+    char *p;
+    bool allCheck = true;
+
+    /* Reset the heap and free any records in the range list */
+    mm_stop_background();
+    mem_reset_brk();
+    reinit_trace(trace);
+    clear_range_set(ranges);
+
+    /* Call the mm package's init function */
+    if (!mm_init()) {
+        malloc_error(trace, 0, "mm_init failed.");
+        return false;
+    }
+
+    /* Interpret each operation in the trace in order */
+    for (i = 0;  i < trace->num_ops;  i++) {
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
+        /* Halfway through, restart on the heap the file holds */
+        if (heap_file != NULL && i == trace->num_ops / 2
+            && !reopen_heap(trace, i))
+            return false;
+
         if (debug_mode == DBG_EXPENSIVE) {
             range_t *r;
 
@@ -1140,15 +2186,49 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     return allCheck;
 }
 
+/*
+ * reopen_heap - checkpoint the heap, unmap it, and take it over again
+ *   from its file, as a process restarted on the file would. The blocks
+ *   the trace holds stay at the same addresses, so checking them from
+ *   here on checks what the file kept.
+ */
+static bool reopen_heap(trace_t *trace, int opnum)
+{
+    struct timespec start, end;
+    size_t heapsize = mem_heapsize();
+
+    if (!mm_checkpoint()) {
+        malloc_error(trace, opnum, "mm_checkpoint failed.");
+        return false;
+    }
+    mm_stop_background();
+    mem_deinit();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mem_init(false);
+    if (!mm_reopen()) {
+        malloc_error(trace, opnum, "mm_reopen failed.");
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!mm_checkheap(__LINE__)) {
+        malloc_error(trace, opnum, "mm_checkheap failed after mm_reopen.");
+        return false;
+    }
+    if (verbose > 1)
+        printf("reopened %zu heap bytes in %.3f ms, ", heapsize,
+               (end.tv_sec - start.tv_sec) * 1e3
+               + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return true;
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak size of the heap in bytes while running the student's malloc
+ *   package on the trace. mem_sbrk() can shrink the heap, so the
+ *   final brk need not be its high water mark.
  *
  *   A higher number is better: 1 is optimal.
  */
@@ -1165,6 +2245,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     reinit_trace(trace);
 
     /* initialize the heap and the mm malloc package */
+    mm_stop_background();
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
@@ -1235,7 +2316,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -1252,6 +2333,7 @@ static void eval_mm_speed(void *ptr)
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
+    mm_stop_background();
     mem_reset_brk();
     if (!mm_init())
         app_error("mm_init failed in eval_mm_speed");
@@ -1292,6 +2374,924 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_stream - Check the mm malloc package for correctness, measure
+ *    its utilization and time it, all in a single pass over the requests
+ *    stream hands over. Only the mm calls are timed, with the cycle
+ *    counter around each one as in eval_latency, so neither the driver's
+ *    checks nor the wait for the reader count.
+ */
+static bool eval_mm_stream(trace_t *trace, stream_t *stream,
+                           range_set_t *ranges, stats_t *stats)
+{
+    const chunk_t *chunk;
+    traceop_t *op;
+    struct timespec start, end;
+    uint64_t opnum = 0;
+    uint64_t overhead, first, last, t0, in_mm = 0;
+    size_t size, oldsize;
+    size_t total_size = 0, max_total_size = 0;
+    int i, index, num_slots = 0;
+    char *p, *newp, *oldp;
+    bool allCheck = true;
+
+    mm_stop_background();
+    mem_reset_brk();
+    if (!mm_init()) {
+        malloc_error(trace, 0, "mm_init failed.");
+        return false;
+    }
+
+    overhead = cycle_overhead();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    first = read_cycles();
+    do {
+        chunk = next_chunk(stream);
+
+        /* Grow the block tables to the slots the chunk uses */
+        if (chunk->num_slots > num_slots) {
+            int grown = num_slots ? num_slots : 1024;
+            while (grown < chunk->num_slots)
+                grown *= 2;
+            trace->blocks = realloc(trace->blocks, grown * sizeof(char *));
+            trace->block_sizes = realloc(trace->block_sizes,
+                                         grown * sizeof(size_t));
+            trace->block_rand_base = realloc(trace->block_rand_base,
+                                             grown * sizeof(int));
+            if (trace->blocks == NULL || trace->block_sizes == NULL
+                || trace->block_rand_base == NULL)
+                unix_error("realloc failed in eval_mm_stream");
+            memset(trace->blocks + num_slots, 0,
+                   (grown - num_slots) * sizeof(char *));
+            memset(trace->block_sizes + num_slots, 0,
+                   (grown - num_slots) * sizeof(size_t));
+            num_slots = grown;
+            trace->num_ids = grown;
+        }
+
+        for (i = 0; i < chunk->num_ops; i++, opnum++) {
+            op = &chunk->ops[i];
+            index = op->index;
+            size = op->size;
+
+            if (debug_mode == DBG_EXPENSIVE) {
+                range_t *r;
+
+                if (!mm_checkheap(0)) {
+                    malloc_error(trace, opnum, "mm_checkheap returned false\n");
+                    return false;
+                }
+                for (r = ranges->list; r != NULL; r = r->next)
+                    if (!check_index(trace, opnum, r->index))
+                        allCheck = false;
+            }
+
+            switch (op->type) {
+
+            case ALLOC: /* mm_malloc */
+                t0 = read_cycles();
+                p = mm_malloc(size);
+                in_mm += read_cycles() - t0;
+                if (p == NULL) {
+                    malloc_error(trace, opnum, "mm_malloc failed.");
+                    return false;
+                }
+                if (!add_range(ranges, p, size, trace, opnum, index))
+                    return false;
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                randomize_block(trace, index);
+                total_size += size;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                if (!check_index(trace, opnum, index))
+                    allCheck = false;
+                oldp = trace->blocks[index];
+                oldsize = trace->block_sizes[index];
+                t0 = read_cycles();
+                newp = mm_realloc(oldp, size);
+                in_mm += read_cycles() - t0;
+                if (newp == NULL && size != 0) {
+                    malloc_error(trace, opnum, "mm_realloc failed.");
+                    return false;
+                }
+                if (newp != NULL && size == 0) {
+                    malloc_error(trace, opnum, "mm_realloc with size 0 "
+                                 "returned non-NULL.");
+                    return false;
+                }
+                remove_range(ranges, oldp);
+                if (size > 0 && !add_range(ranges, newp, size, trace, opnum,
+                                           index))
+                    return false;
+
+                /* Check up to min(size, oldsize) for correct copying */
+                trace->blocks[index] = newp;
+                if (size < oldsize)
+                    trace->block_sizes[index] = size;
+                if (!check_index(trace, opnum, index))
+                    allCheck = false;
+                trace->block_sizes[index] = size;
+                randomize_block(trace, index);
+                total_size += size - oldsize;
+                break;
+
+            case FREE: /* mm_free */
+                if (!check_index(trace, opnum, index))
+                    allCheck = false;
+                p = NULL;
+                if (index >= 0) {
+                    /* The slot may go to another id from here on */
+                    p = trace->blocks[index];
+                    remove_range(ranges, p);
+                    total_size -= trace->block_sizes[index];
+                    trace->blocks[index] = NULL;
+                    trace->block_sizes[index] = 0;
+                }
+                t0 = read_cycles();
+                mm_free(p);
+                in_mm += read_cycles() - t0;
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_stream");
+            }
+
+            if (total_size > max_total_size)
+                max_total_size = total_size;
+        }
+
+        if (chunk->failed) {
+            malloc_error(trace, opnum, "%s", stream->error);
+            return false;
+        }
+    } while (!chunk->last);
+    last = read_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+#if !REF_ONLY
+    printf(".");
+#endif
+
+    stats->ops = opnum;
+    stats->util = (double) max_total_size / (double) mem_peak_heapsize();
+    /* Take the counter's own cost off each call, and turn the cycles
+       into seconds by the clock over the whole pass */
+    in_mm = in_mm > opnum * overhead ? in_mm - opnum * overhead : 0;
+    stats->secs = sparse_mode ? 1.0 : in_mm * ((end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9)
+        / (double)(last > first ? last - first : 1);
+    stats->tput = stats->ops / (stats->secs * 1000.0);
+    return allCheck;
+}
+
+/*
+ * eval_mm_huge - Measure utilization and throughput again on a heap
+ *    backed by huge pages, with large blocks aligned to them.  Leaves
+ *    the huge-page heap in place for run_tests to free.
+ */
+static void eval_mm_huge(speed_t *speed_params, int tracenum, stats_t *stats)
+{
+    mm_stop_background();
+    mem_deinit();
+    mem_set_huge_pages(true);
+    mm_set_huge_align(true);
+    mem_init(false);
+
+    stats->util_huge = eval_mm_util(speed_params->trace, tracenum);
+    stats->pages_huge = mem_pages();
+    stats->tput_huge = stats->ops / (fsec(eval_mm_speed, speed_params) * 1000.0);
+
+    mem_set_huge_pages(false);
+    mm_set_huge_align(policy_enabled("huge"));
+}
+
+/*
+ * eval_mm_locality - Replay the trace through the mm package with cache
+ *    coloring switched on or off, walking the most recently allocated
+ *    small objects that fit the cache at WALK_SNAPSHOTS evenly spaced
+ *    points. Returns the miss rate of the walks in the simulated cache.
+ */
+static double eval_mm_locality(trace_t *trace, bool color)
+{
+    int i, index;
+    int interval = trace->num_ops / WALK_SNAPSHOTS;
+    char *p, *newp, *oldp;
+    cache_sim_t *cache;
+    walk_set_t *recent;
+
+    if ((cache = (cache_sim_t *) malloc(sizeof(cache_sim_t))) == NULL
+        || (recent = (walk_set_t *) calloc(1, sizeof(walk_set_t))) == NULL)
+        unix_error("malloc failed in eval_mm_locality");
+    cache->accesses = 0;
+    cache->misses = 0;
+    if (interval == 0)
+        interval = 1;
+
+    reinit_trace(trace);
+    mm_set_coloring(color);
+    mm_stop_background();
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_locality");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                app_error("mm_malloc error in eval_mm_locality");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = trace->ops[i].size;
+            walk_record(recent, index, p, trace->ops[i].size);
+            break;
+
+        case REALLOC: /* mm_realloc */
+            oldp = trace->blocks[index];
+            newp = mm_realloc(oldp, trace->ops[i].size);
+            if (newp == NULL && trace->ops[i].size != 0)
+                app_error("mm_realloc error in eval_mm_locality");
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = trace->ops[i].size;
+            walk_record(recent, index, newp, trace->ops[i].size);
+            break;
+
+        case FREE: /* mm_free */
+            if (index >= 0) {
+                mm_free(trace->blocks[index]);
+                trace->blocks[index] = NULL;
+                trace->block_sizes[index] = 0;
+            }
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_locality");
+        }
+
+        if ((i + 1) % interval == 0)
+            walk_live_objects(trace, cache, recent);
+    }
+
+    double miss_rate = cache->accesses > 0 ? cache->misses / cache->accesses : 0;
+    free(cache);
+    free(recent);
+    return miss_rate;
+}
+
+/*
+ * walk_record - note an allocation of size bytes at block for id index,
+ *    if it is small enough to be walked whole
+ */
+static void walk_record(walk_set_t *recent, int index, char *block,
+                        size_t size)
+{
+    if (block == NULL || size == 0 || size > WALK_BYTES)
+        return;
+    recent->index[recent->next] = index;
+    recent->block[recent->next] = block;
+    recent->next = (recent->next + 1) % WALK_RECENT;
+}
+
+/*
+ * walk_live_objects - Touch the recently allocated small objects that are
+ *    still live, newest first, until their lines would fill half the
+ *    cache, and then the same objects again. Only the second walk is
+ *    counted, so the misses are the conflicts among a working set that
+ *    fits the cache, which is where placement shows.
+ */
+static void walk_live_objects(trace_t *trace, cache_sim_t *cache,
+                              const walk_set_t *recent)
+{
+    int pass, k, slot, index;
+    int count = 0;
+    double accesses = cache->accesses;
+    double misses = cache->misses;
+    unsigned long budget = CACHE_SETS * CACHE_WAYS / 2;
+    unsigned long lines = 0;
+
+    /* Find how many of the newest live objects fit the cache */
+    for (k = 1; k <= WALK_RECENT; k++, count++) {
+        slot = (recent->next - k + WALK_RECENT) % WALK_RECENT;
+        index = recent->index[slot];
+        if (recent->block[slot] == NULL)
+            break;
+        if (trace->blocks[index] != recent->block[slot])
+            continue;
+        lines += ((unsigned long) recent->block[slot]
+                  + trace->block_sizes[index] - 1) / CACHE_LINE
+            - (unsigned long) recent->block[slot] / CACHE_LINE + 1;
+        if (lines > budget)
+            break;
+    }
+
+    cache_reset(cache);
+    for (pass = 0; pass < 2; pass++) {
+        /* The first walk only warms up the cache */
+        if (pass == 1) {
+            cache->accesses = accesses;
+            cache->misses = misses;
+        }
+        for (k = 1; k <= count; k++) {
+            unsigned long lo, addr;
+            slot = (recent->next - k + WALK_RECENT) % WALK_RECENT;
+            index = recent->index[slot];
+            if (trace->blocks[index] != recent->block[slot])
+                continue;
+            lo = (unsigned long) recent->block[slot];
+            for (addr = lo & ~(CACHE_LINE - 1UL);
+                 addr < lo + trace->block_sizes[index]; addr += CACHE_LINE)
+                cache_access(cache, addr);
+        }
+    }
+}
+
+/*
+ * cache_reset - empty the simulated cache
+ */
+static void cache_reset(cache_sim_t *cache)
+{
+    memset(cache->used, 0, sizeof(cache->used));
+    cache->clock = 0;
+}
+
+/*
+ * cache_access - look up one line in the simulated cache, counting a
+ *    miss and evicting the least recently used way if it isn't there
+ */
+static void cache_access(cache_sim_t *cache, unsigned long addr)
+{
+    unsigned long line = addr / CACHE_LINE;
+    unsigned long set = line % CACHE_SETS;
+    int way, victim = 0;
+
+    cache->clock++;
+    cache->accesses++;
+    for (way = 0; way < CACHE_WAYS; way++) {
+        if (cache->used[set][way] != 0 && cache->tag[set][way] == line) {
+            cache->used[set][way] = cache->clock;
+            return;
+        }
+        if (cache->used[set][way] < cache->used[set][victim])
+            victim = way;
+    }
+    cache->misses++;
+    cache->tag[set][victim] = line;
+    cache->used[set][victim] = cache->clock;
+}
+
+/*
+ * run_pipeline - Pass blocks from producer to consumer threads with
+ *    owned slab heaps, shared lock-free slabs, and one global lock,
+ *    and print the throughput of each
+ */
+static void run_pipeline(int pairs)
+{
+    double owned = eval_mm_pipeline(pairs, false, true);
+    double shared = eval_mm_pipeline(pairs, true, false);
+    double locked = eval_mm_pipeline(pairs, false, false);
+
+    printf("%d producer/consumer pairs, %d blocks each\n", pairs, PIPE_OPS);
+    printf("  owned heaps:   %10.0f Kops/sec\n", owned);
+    printf("  shared slabs:  %10.0f Kops/sec\n", shared);
+    printf("  global lock:   %10.0f Kops/sec\n", locked);
+}
+
+static pthread_mutex_t pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool pipe_locked;         /* Serialize mm calls through pipe_mutex */
+
+/*
+ * eval_mm_pipeline - Run the pairs over a fresh heap with the given
+ *    slab policies, and return the malloc and free throughput in Kops/s
+ */
+static double eval_mm_pipeline(int pairs, bool slab, bool owned)
+{
+    pipe_t *pipes = calloc(pairs, sizeof(pipe_t));
+    struct timespec start, end;
+    double secs;
+    int i;
+
+    if (pipes == NULL)
+        unix_error("pipes calloc in eval_mm_pipeline failed");
+    mem_init(false);
+    mm_set_slab(slab);
+    mm_set_owned_heaps(owned);
+    pipe_locked = !slab && !owned;
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_pipeline");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < pairs; i++) {
+        pthread_create(&pipes[i].producer, NULL, pipe_producer, &pipes[i]);
+        pthread_create(&pipes[i].consumer, NULL, pipe_consumer, &pipes[i]);
+    }
+    for (i = 0; i < pairs; i++) {
+        pthread_join(pipes[i].producer, NULL);
+        pthread_join(pipes[i].consumer, NULL);
+        if (pipes[i].failed)
+            errors = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!mm_checkheap(__LINE__)) {
+        printf("ERROR: heap check failed after the pipeline benchmark\n");
+        errors = 1;
+    }
+    if (verbose > 1) {
+        size_t remote;
+        size_t owners = mm_owned_stats(&remote);
+        if (owners > 0)
+            printf("%zu owners, %zu remote frees\n", owners, remote);
+    }
+    mm_stop_background();
+    mem_deinit();
+    free(pipes);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return 2.0 * PIPE_OPS * pairs / secs / 1000.0;
+}
+
+/*
+ * pipe_producer - Allocate blocks of 8 to 56 bytes, fill each with
+ *    its size, and hand them to the consumer
+ */
+static void *pipe_producer(void *arg)
+{
+    pipe_t *pipe = arg;
+    size_t i;
+
+    for (i = 0; i < PIPE_OPS; i++) {
+        size_t size = 8 + (i * 37) % 49;
+        unsigned char *p;
+
+        while (i - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) >= PIPE_SLOTS)
+            sched_yield();
+        if (pipe_locked)
+            pthread_mutex_lock(&pipe_mutex);
+        p = mm_malloc(size);
+        if (pipe_locked)
+            pthread_mutex_unlock(&pipe_mutex);
+        if (p == NULL) {
+            pipe->failed = true;
+            printf("ERROR: mm_malloc failed in the pipeline benchmark\n");
+            break;
+        }
+        memset(p, (int)size, size);
+        pipe->slot[i % PIPE_SLOTS] = p;
+        __atomic_store_n(&pipe->head, i + 1, __ATOMIC_RELEASE);
+    }
+    /* A NULL block tells the consumer to stop */
+    while (i - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) >= PIPE_SLOTS)
+        sched_yield();
+    pipe->slot[i % PIPE_SLOTS] = NULL;
+    __atomic_store_n(&pipe->head, i + 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * pipe_consumer - Check that each block still holds its size, and free it
+ */
+static void *pipe_consumer(void *arg)
+{
+    pipe_t *pipe = arg;
+    size_t i;
+
+    for (i = 0; ; i++) {
+        unsigned char *p;
+
+        while (__atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == i)
+            sched_yield();
+        p = pipe->slot[i % PIPE_SLOTS];
+        if (p == NULL)
+            break;
+        if (p[p[0] - 1] != p[0]) {
+            pipe->failed = true;
+            printf("ERROR: block %p was damaged in the pipeline benchmark\n",
+                   (void *)p);
+        }
+        if (pipe_locked)
+            pthread_mutex_lock(&pipe_mutex);
+        mm_free(p);
+        if (pipe_locked)
+            pthread_mutex_unlock(&pipe_mutex);
+        __atomic_store_n(&pipe->tail, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * replay_trace - replay the threads of the trace at once, with mm and
+ *    then with libc, and fill in the replay stats
+ */
+static void replay_trace(trace_t *trace, stats_t *stats)
+{
+    replay_t *replay = new_replay(trace);
+    double secs;
+    int t;
+
+    stats->threads = replay->num_threads;
+    stats->waits = replay->num_waits;
+    for (t = 0; t < replay->num_threads; t++)
+        stats->thread_ops[t] = replay->threads[t].num_ops;
+
+    secs = eval_replay(replay, false, stats->thread_ns);
+    stats->replay_locked = replay->locked;
+    stats->tput_replay = stats->ops / (secs * 1000.0);
+    secs = eval_replay(replay, true, stats->thread_ns_libc);
+    stats->tput_replay_libc = stats->ops / (secs * 1000.0);
+    free_replay(replay);
+}
+
+/*
+ * new_replay - split the requests of the trace by thread, and find the
+ *    ones that must wait for a request of another thread
+ */
+static replay_t *new_replay(trace_t *trace)
+{
+    replay_t *replay = calloc(1, sizeof(replay_t));
+    int *last = malloc(trace->num_ids * sizeof(int));  /* last request on id */
+    int *count = calloc(trace->num_ids, sizeof(int));  /* requests on id */
+    int i, t, index;
+
+    if (replay == NULL || last == NULL || count == NULL)
+        unix_error("calloc in new_replay failed");
+    replay->trace = trace;
+    for (i = 0; i < trace->num_ops; i++)
+        if (trace->ops[i].thread >= replay->num_threads)
+            replay->num_threads = trace->ops[i].thread + 1;
+    if (replay->num_threads > MAX_REPLAY_THREADS)
+        app_error("%s: %d threads, but -R replays at most %d",
+                  trace->filename, replay->num_threads, MAX_REPLAY_THREADS);
+
+    replay->wait = malloc(trace->num_ops * sizeof(int));
+    replay->post = malloc(trace->num_ops * sizeof(int));
+    replay->done = calloc(trace->num_ids, sizeof(int));
+    if (replay->wait == NULL || replay->post == NULL || replay->done == NULL)
+        unix_error("malloc in new_replay failed");
+    memset(last, -1, trace->num_ids * sizeof(int));
+
+    for (i = 0; i < trace->num_ops; i++) {
+        t = trace->ops[i].thread;
+        index = trace->ops[i].index;
+        replay->threads[t].num_ops++;
+        replay->wait[i] = replay->post[i] = -1;
+        if (index < 0)
+            continue;
+        if (last[index] >= 0 && trace->ops[last[index]].thread != t) {
+            replay->wait[i] = count[index];
+            replay->post[last[index]] = count[index];
+            replay->num_waits++;
+        }
+        last[index] = i;
+        count[index]++;
+    }
+
+    for (t = 0; t < replay->num_threads; t++) {
+        replay->threads[t].ops = malloc(replay->threads[t].num_ops * sizeof(int));
+        if (replay->threads[t].ops == NULL && replay->threads[t].num_ops > 0)
+            unix_error("malloc in new_replay failed");
+        replay->threads[t].num_ops = 0;
+        replay->threads[t].replay = replay;
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+        replay_thread_t *thread = &replay->threads[trace->ops[i].thread];
+        thread->ops[thread->num_ops++] = i;
+    }
+    free(last);
+    free(count);
+    return replay;
+}
+
+/*
+ * free_replay - free the replay and the arrays new_replay allocated
+ */
+static void free_replay(replay_t *replay)
+{
+    int t;
+
+    for (t = 0; t < replay->num_threads; t++)
+        free(replay->threads[t].ops);
+    free(replay->wait);
+    free(replay->post);
+    free(replay->done);
+    free(replay);
+}
+
+static pthread_mutex_t replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * eval_replay - Replay the threads of the trace at once, REPLAY_RUNS
+ *    times, with libc or with mm on a fresh heap. Returns the secs of the
+ *    fastest run, and sets each thread's fewest ns per request, counting
+ *    only the time it didn't spend waiting for other threads. mm calls
+ *    go through replay_mutex unless a policy lets threads into the heap.
+ */
+static double eval_replay(replay_t *replay, bool libc, double *thread_ns)
+{
+    trace_t *trace = replay->trace;
+    struct timespec start, end;
+    double secs, best = 0, ns;
+    int run, t;
+
+    replay->libc = libc;
+    replay->locked = false;
+    for (run = 0; run < REPLAY_RUNS; run++) {
+        reinit_trace(trace);
+        memset(replay->done, 0, trace->num_ids * sizeof(int));
+        if (!libc) {
+            mm_stop_background();
+            mem_reset_brk();
+            if (!mm_init())
+                app_error("mm_init failed in eval_replay");
+            replay->locked = !mm_fine_locks() && !policy_enabled("slab")
+                             && !policy_enabled("owned")
+                             && !policy_enabled("background");
+        }
+
+        replay->go = false;
+        for (t = 0; t < replay->num_threads; t++) {
+            replay->threads[t].busy = 0;
+            if (pthread_create(&replay->threads[t].thread, NULL,
+                               replay_thread, &replay->threads[t]) != 0)
+                unix_error("pthread_create in eval_replay failed");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        __atomic_store_n(&replay->go, true, __ATOMIC_RELEASE);
+        for (t = 0; t < replay->num_threads; t++)
+            pthread_join(replay->threads[t].thread, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (run == 0 || secs < best)
+            best = secs;
+        for (t = 0; t < replay->num_threads; t++) {
+            if (replay->threads[t].num_ops == 0)
+                continue;
+            ns = replay->threads[t].busy / replay->threads[t].num_ops * 1e9;
+            if (run == 0 || ns < thread_ns[t])
+                thread_ns[t] = ns;
+        }
+    }
+    return best;
+}
+
+/*
+ * replay_thread - Make one thread's requests in order, each after the
+ *    request of another thread it waits for, if any
+ */
+static void *replay_thread(void *arg)
+{
+    replay_thread_t *self = arg;
+    replay_t *replay = self->replay;
+    trace_t *trace = replay->trace;
+    struct timespec start, now;
+    traceop_t *op;
+    char *p;
+    int i, k;
+
+    while (!__atomic_load_n(&replay->go, __ATOMIC_ACQUIRE))
+        sched_yield();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < self->num_ops; i++) {
+        k = self->ops[i];
+        op = &trace->ops[k];
+        if (replay->wait[k] >= 0
+            && __atomic_load_n(&replay->done[op->index], __ATOMIC_ACQUIRE)
+               < replay->wait[k]) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            self->busy += (now.tv_sec - start.tv_sec)
+                          + (now.tv_nsec - start.tv_nsec) / 1e9;
+            while (__atomic_load_n(&replay->done[op->index], __ATOMIC_ACQUIRE)
+                   < replay->wait[k])
+                sched_yield();
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+
+        if (replay->locked)
+            pthread_mutex_lock(&replay_mutex);
+        switch (op->type) {
+        case ALLOC:
+            p = replay->libc ? malloc(op->size) : mm_malloc(op->size);
+            if (p == NULL)
+                app_error("malloc failed in replay_thread");
+            trace->blocks[op->index] = p;
+            break;
+
+        case REALLOC:
+            p = trace->blocks[op->index];
+            p = replay->libc ? realloc(p, op->size) : mm_realloc(p, op->size);
+            if (p == NULL && op->size != 0)
+                app_error("realloc failed in replay_thread");
+            trace->blocks[op->index] = p;
+            break;
+
+        case FREE:
+            p = op->index < 0 ? NULL : trace->blocks[op->index];
+            if (replay->libc)
+                free(p);
+            else
+                mm_free(p);
+            break;
+
+        default:
+            app_error("Nonexistent request type in replay_thread");
+        }
+        if (replay->locked)
+            pthread_mutex_unlock(&replay_mutex);
+
+        if (replay->post[k] >= 0)
+            __atomic_store_n(&replay->done[op->index], replay->post[k],
+                             __ATOMIC_RELEASE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    self->busy += (now.tv_sec - start.tv_sec)
+                  + (now.tv_nsec - start.tv_nsec) / 1e9;
+    return NULL;
+}
+
+/*
+ * eval_latency - Replay the trace in order with libc or with mm on a
+ *    fresh heap, timing each request alone with the cycle counter, and
+ *    fill in latency from the histograms of each request type. The
+ *    least time between two reads of the counter is taken off each
+ *    request's time, and cycles are turned into ns by timing the whole
+ *    replay with the clock as well.
+ */
+static void eval_latency(trace_t *trace, bool libc, latency_t *latency)
+{
+    uint64_t *hist = calloc(3 * HIST_BUCKETS, sizeof(uint64_t));
+    uint64_t count[3] = { 0, 0, 0 }, max[3] = { 0, 0, 0 };
+    uint64_t worst[LATENCY_WORST];
+    uint64_t overhead, first, last, t0, t1, cycles;
+    struct timespec start, end;
+    double ns_per_cycle;
+    traceop_t *op;
+    char *p;
+    int i, j, type;
+
+    if (hist == NULL)
+        unix_error("calloc in eval_latency failed");
+    overhead = cycle_overhead();
+    for (j = 0; j < LATENCY_WORST; j++) {
+        worst[j] = 0;
+        latency->worst_op[j] = -1;
+    }
+
+    reinit_trace(trace);
+    if (!libc) {
+        mm_stop_background();
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in eval_latency");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    first = read_cycles();
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        switch (op->type) {
+        case ALLOC:
+            t0 = read_cycles();
+            p = libc ? malloc(op->size) : mm_malloc(op->size);
+            t1 = read_cycles();
+            if (p == NULL)
+                app_error("malloc failed in eval_latency");
+            trace->blocks[op->index] = p;
+            break;
+
+        case REALLOC:
+            p = trace->blocks[op->index];
+            t0 = read_cycles();
+            p = libc ? realloc(p, op->size) : mm_realloc(p, op->size);
+            t1 = read_cycles();
+            if (p == NULL && op->size != 0)
+                app_error("realloc failed in eval_latency");
+            trace->blocks[op->index] = p;
+            break;
+
+        case FREE:
+            p = op->index < 0 ? NULL : trace->blocks[op->index];
+            t0 = read_cycles();
+            if (libc)
+                free(p);
+            else
+                mm_free(p);
+            t1 = read_cycles();
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_latency");
+        }
+
+        type = op->type;
+        cycles = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+        hist[type * HIST_BUCKETS + hist_bucket(cycles)]++;
+        count[type]++;
+        if (cycles > max[type])
+            max[type] = cycles;
+        if (cycles > worst[LATENCY_WORST - 1]) {
+            /* Keep the slowest requests, slowest first */
+            for (j = LATENCY_WORST - 1; j > 0 && cycles > worst[j - 1]; j--) {
+                worst[j] = worst[j - 1];
+                latency->worst_op[j] = latency->worst_op[j - 1];
+            }
+            worst[j] = cycles;
+            latency->worst_op[j] = i;
+        }
+    }
+    last = read_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns_per_cycle = ((end.tv_sec - start.tv_sec) * 1e9
+                    + (end.tv_nsec - start.tv_nsec))
+                   / (double)(last > first ? last - first : 1);
+    for (type = 0; type < 3; type++) {
+        uint64_t *h = &hist[type * HIST_BUCKETS];
+        /* A bucket's top can lie above the largest value in it */
+        latency->count[type] = count[type];
+        latency->p50[type] = ns_per_cycle
+            * fmin(hist_percentile(h, count[type], 0.5), max[type]);
+        latency->p99[type] = ns_per_cycle
+            * fmin(hist_percentile(h, count[type], 0.99), max[type]);
+        latency->p999[type] = ns_per_cycle
+            * fmin(hist_percentile(h, count[type], 0.999), max[type]);
+        latency->max[type] = ns_per_cycle * max[type];
+    }
+    for (j = 0; j < LATENCY_WORST; j++)
+        latency->worst_ns[j] = worst[j] * ns_per_cycle;
+    free(hist);
+}
+
+/*
+ * read_cycles - the time-stamp counter, on x86, or else the clock in ns
+ */
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/*
+ * cycle_overhead - the least time between two reads of the cycle counter
+ */
+static uint64_t cycle_overhead(void)
+{
+    uint64_t overhead = UINT64_MAX, t0, t1;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        t0 = read_cycles();
+        t1 = read_cycles();
+        if (t1 - t0 < overhead)
+            overhead = t1 - t0;
+    }
+    return overhead;
+}
+
+/*
+ * hist_bucket - the bucket of a latency histogram that counts cycles
+ */
+static inline int hist_bucket(uint64_t cycles)
+{
+    int shift;
+
+    if (cycles < 2 * HIST_SUB)
+        return cycles;
+    shift = 63 - __builtin_clzll(cycles) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)(cycles >> shift) - HIST_SUB;
+}
+
+/*
+ * hist_percentile - the least value of which at least fraction of the
+ *    count values in hist are no more, rounded up to the top of its bucket
+ */
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count,
+                                double fraction)
+{
+    uint64_t rank = ceil(fraction * count), seen = 0;
+    int b, shift;
+
+    if (count == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < HIST_BUCKETS - 1; b++) {
+        seen += hist[b];
+        if (seen >= rank)
+            break;
+    }
+    if (b < 2 * HIST_SUB)
+        return b;
+    shift = b / HIST_SUB - 1;
+    return ((uint64_t)(b % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1396,6 +3396,81 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * enable_policy - switch on the mm policy with the given name
+ */
+static void enable_policy(const char *name)
+{
+    policy_t *p;
+    for (p = mm_policies; p->name != NULL; p++) {
+        if (strcmp(p->name, name) == 0) {
+            p->enable(true);
+            p->enabled = true;
+            return;
+        }
+    }
+    app_error("Unknown mm policy \"%s\"\n", name);
+}
+
+/*
+ * policy_enabled - was the mm policy with the given name switched on by -o?
+ */
+static bool policy_enabled(const char *name)
+{
+    const policy_t *p;
+    for (p = mm_policies; p->name != NULL; p++) {
+        if (strcmp(p->name, name) == 0)
+            return p->enabled;
+    }
+    return false;
+}
+
+/*
+ * print_policy_stats - report what the enabled mm policies did during
+ *                      the last run of a trace
+ */
+static void print_policy_stats(void)
+{
+    size_t lookups, hits;
+    bool active = mm_exact_cache_stats(&lookups, &hits);
+    if (lookups > 0) {
+        printf("exact-size cache: %zu of %zu lookups hit (%.1f%%)%s, ",
+               hits, lookups, 100.0 * hits / lookups,
+               active ? "" : ", then disabled");
+    }
+    size_t allocs, nursery;
+    mm_lifetime_stats(&allocs, &nursery);
+    if (allocs > 0) {
+        printf("nursery: %zu of %zu blocks (%.1f%%), ",
+               nursery, allocs, 100.0 * nursery / allocs);
+    }
+    if (mm_compact_mode()) {
+        printf("compact mode, ");
+    }
+    if (mem_pages() != MEM_PAGES_BASE) {
+        printf("%s pages, ", mem_pages() == MEM_PAGES_HUGETLB ? "hugetlb" : "THP");
+    }
+    size_t purged = mm_purge_stats();
+    if (purged > 0) {
+        printf("purged %zu bytes, ", purged);
+    }
+    size_t remapped = mm_remap_stats();
+    if (remapped > 0) {
+        printf("remapped %zu bytes, ", remapped);
+    }
+    size_t pages = mm_slab_stats();
+    if (pages > 0) {
+        printf("%zu slab pages, ", pages);
+    }
+    size_t remote;
+    size_t owners = mm_owned_stats(&remote);
+    if (owners > 0) {
+        printf("%zu owners, %zu remote frees, ", owners, remote);
+    }
+    printf("heap %zu bytes, %zu committed, %zu resident, ",
+           mem_heapsize(), mem_committed(), mem_resident());
+}
+
 /*
  * printresults - prints a performance summary for some malloc package and returns
  *                a summary of the stats to the caller.
@@ -1568,6 +3643,124 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * printlocality - prints the miss rates measured by the locality benchmark
+ */
+static void printlocality(int n, stats_t *stats)
+{
+    int i;
+    printf("Locality of recent-object walks (%d-set %d-way cache, %d-byte lines):\n",
+           CACHE_SETS, CACHE_WAYS, CACHE_LINE);
+    printf("  %8s %8s %8s  %s\n", "plain", "colored", "change", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %7.2f%% %7.2f%% %+7.2f%%  %s\n",
+               stats[i].miss_plain * 100.0, stats[i].miss_colored * 100.0,
+               (stats[i].miss_colored - stats[i].miss_plain) * 100.0,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printhuge - prints utilization and throughput with and without huge
+ *             pages, as measured by the huge-page comparison
+ */
+static void printhuge(int n, stats_t *stats)
+{
+    int i;
+    printf("Huge pages (%d KB, %s) with huge-page alignment of large blocks:\n",
+           HUGE_PAGE_SIZE >> 10,
+           (n > 0 && stats[0].pages_huge == MEM_PAGES_HUGETLB) ? "hugetlb"
+           : (n > 0 && stats[0].pages_huge == MEM_PAGES_THP) ? "THP"
+           : "unavailable");
+    printf("  %7s %7s %9s %9s %7s  %s\n",
+           "util", "huge", "Kops", "huge", "change", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %6.1f%% %6.1f%% %9.0f %9.0f %+6.1f%%  %s\n",
+               stats[i].util * 100.0, stats[i].util_huge * 100.0,
+               stats[i].tput, stats[i].tput_huge,
+               (stats[i].tput_huge / stats[i].tput - 1.0) * 100.0,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printreplay - prints the throughput of each trace with its threads
+ *               replayed at once, and each thread's time per request
+ */
+static void printreplay(int n, stats_t *stats)
+{
+    int i, t;
+    printf("Threads of each trace replayed at once, one thread each:\n");
+    printf("  %7s %8s %9s %9s  %s\n", "threads", "waits", "Kops", "libc",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %7d %8d %9.0f %9.0f  %s%s\n", stats[i].threads,
+               stats[i].waits, stats[i].tput_replay, stats[i].tput_replay_libc,
+               stats[i].filename,
+               stats[i].replay_locked ? " (mm under one lock)" : "");
+        for (t = 0; t < stats[i].threads; t++) {
+            if (stats[i].thread_ops[t] == 0)
+                continue;
+            printf("  %7s thread %d: %.0f requests, %.0f ns each, "
+                   "%.0f ns with libc\n", "", t, stats[i].thread_ops[t],
+                   stats[i].thread_ns[t], stats[i].thread_ns_libc[t]);
+        }
+    }
+}
+
+/*
+ * printlatency - prints the latency percentiles of each request type, and
+ *                the slowest requests, as found by the latency replay
+ */
+static void printlatency(const char *name, int n, stats_t *stats)
+{
+    static const char *types[3] = { "malloc", "free", "realloc" };
+    const latency_t *l;
+    int i, j, type;
+    printf("Latency of each request with %s (ns):\n", name);
+    printf("  %-8s %9s %8s %8s %8s %9s  %s\n", "request", "count", "p50",
+           "p99", "p99.9", "max", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        l = &stats[i].latency;
+        for (type = 0; type < 3; type++) {
+            if (l->count[type] == 0)
+                continue;
+            printf("  %-8s %9.0f %8.0f %8.0f %8.0f %9.0f  %s\n", types[type],
+                   l->count[type], l->p50[type], l->p99[type],
+                   l->p999[type], l->max[type], stats[i].filename);
+        }
+        printf("  %-8s", "slowest");
+        for (j = 0; j < LATENCY_WORST && l->worst_op[j] >= 0; j++)
+            printf(" #%d (%.0f)", l->worst_op[j], l->worst_ns[j]);
+        printf("\n");
+    }
+}
+
+/*
+ * printmemory - prints what each trace's heap cost in memory, as committed
+ *               address space and as resident pages, beside its brk size
+ */
+static void printmemory(int n, stats_t *stats)
+{
+    int i;
+    printf("Memory cost at the end of each trace (KB):\n");
+    printf("  %10s %10s  %s\n", "committed", "resident", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %10zu %10zu  %s\n", stats[i].committed >> 10,
+               stats[i].resident >> 10, stats[i].filename);
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1702,5 +3895,22 @@ static void usage(char *prog)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-C         Compare cache misses walking recent small blocks with and without coloring\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-F <file>  Keep the heap in <file>, and reopen it from there halfway through each check\n");
+    fprintf(stderr, "\t-H         Compare throughput with and without huge pages\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once, each in a process of its own\n");
+    fprintf(stderr, "\t-J         With -j, time the traces afterwards, one at a time\n");
+    fprintf(stderr, "\t-L <n>[KM] Cap the heap at n bytes, switching mm to compact mode near the cap\n");
+    fprintf(stderr, "\t-M <n>[KMG] Reserve n bytes of address space for the heap (default %d MB)\n",
+            MAX_DENSE_HEAP >> 20);
+    fprintf(stderr, "\t-P         Time each request alone, and report latency percentiles (with -l, for libc too)\n");
+    fprintf(stderr, "\t-R         Replay each trace's threads at once, one thread each, with mm and libc\n");
+    fprintf(stderr, "\t-S         Stream each trace from its file, checking, measuring and timing it in one pass\n");
+    fprintf(stderr, "\t-Q <n>     Run n producer/consumer thread pairs that free across threads\n");
+    fprintf(stderr, "\t-o <name>  Enable mm policy <name>:");
+    const policy_t *p;
+    for (p = mm_policies; p->name != NULL; p++)
+        fprintf(stderr, " %s", p->name);
+    fprintf(stderr, "\n");
 }
@@ -3,149 +3,604 @@
  * because it allows us to interleave calls from the student's malloc
  * package with the system's malloc package in libc.
  *
- * This version has been updated to enable sparse emulation of very large heaps
+ * This version has been updated to enable sparse emulation of very large heaps,
+ * to let several independent heaps, each named by a mem_heap_t, coexist, and
+ * to keep a heap in a file that outlives the process.
+ * The mem_ functions without a handle work on a default heap set up by mem_init.
  */
+#define _GNU_SOURCE             /* For mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <signal.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * Sparse mode reserves a huge range with no access, and materializes a
+ * page, readable and writable, the first time it's touched: through
+ * mem_write, or by mm.c directly, which faults into sparse_fault.  A
+ * chained hash table, keyed by page number, records which pages exist,
+ * so mem_read of a page never touched returns zero without creating it,
+ * and emptying the heap only has to visit the pages that were used.
+ * A sparse heap is single-threaded.
+ */
+typedef struct {
+    uint64_t page;                          /* Page number from heap start */
+    uint32_t next;                          /* Next node in chain, 0 ends it */
+} sparse_node_t;
+
+/* State of one simulated heap */
+struct mem_heap {
+    unsigned char *start;                   /* Starting address of heap */
+    unsigned char *brk;                     /* Current position of break */
+    unsigned char *max_addr;                /* Maximum allowable heap address */
+    unsigned char *fresh;                   /* Lowest address never yet handed out */
+    unsigned char *peak;                    /* Highest break since the last reset */
+    unsigned char *commit;                  /* End of the readable, writable heap */
+    size_t commit_step;                     /* Bytes committed at a time */
+    size_t mmap_length;                     /* Number of bytes reserved by mmap */
+    mem_pages_t pages;                      /* Kind of pages backing the heap */
+    int fd;                                 /* File backing the heap, or -1 */
+    unsigned long epoch;                    /* Changed whenever the heap is emptied */
+    bool sparse;                            /* Emulating a sparse heap? */
+    bool stats_printed;                     /* Has information been printed about allocation */
+
+    /* Sparse mode only */
+    size_t sparse_page;                     /* Bytes per materialized page */
+    sparse_node_t *sparse_nodes;            /* Node pool, node 0 unused */
+    uint32_t sparse_used;                   /* Nodes handed out from pool */
+    uint32_t *sparse_buckets;               /* Chain heads */
+    int sparse_bits;                        /* log2 of the number of buckets */
+    uint64_t sparse_last;                   /* Page the last lookup found */
+    mem_heap_t *sparse_next;                /* Next sparse heap, for sparse_fault */
+};
+
 /* private global variables */
-static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
-static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
-static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
+static mem_heap_t *default_heap;            /* Heap of mem_init and the handle-less calls */
+static size_t mem_limit = 0;                /* Default heap's size limit, 0 for the whole reservation */
+static size_t mem_max_heap = MAX_DENSE_HEAP; /* Bytes the default dense heap reserves */
+static unsigned long mem_epochs;            /* Source of heap epochs, never reused */
+static bool mem_huge = false;               /* Back new dense heaps with huge pages? */
+static const char *mem_file = NULL;         /* File backing the default heap, if any */
 static bool show_stats = false;             /* Should program print allocation information? */
-static bool stats_printed = false;          /* Has information been printed about allocation */
+static mem_heap_t *sparse_heaps;            /* Sparse heaps, which sparse_fault serves */
+static struct sigaction old_segv;           /* Handler sparse_fault replaced */
+
+/* Each thread's reservation for mem_heap_sbrk_local, valid while
+   local_epoch matches the epoch of the heap it is asked of */
+static __thread unsigned char *local_next;
+static __thread unsigned char *local_end;
+static __thread unsigned long local_epoch;
 
-static void print_stats();
+static void print_stats(mem_heap_t *h);
+static void raise_to(unsigned char **mark, unsigned char *addr);
+static bool commit_to(mem_heap_t *h, unsigned char *addr);
+static void decommit_from(mem_heap_t *h, unsigned char *addr);
+static void *huge_reserve(mem_heap_t *h);
+static bool move_pages(unsigned char *dst, unsigned char *src, size_t len);
+static void sparse_init(mem_heap_t *h);
+static void sparse_deinit(mem_heap_t *h);
+static void sparse_clear(mem_heap_t *h);
+static bool sparse_lookup(mem_heap_t *h, uint64_t page);
+static void sparse_materialize(mem_heap_t *h, uint64_t page);
+static void sparse_fault(int sig, siginfo_t *info, void *context);
 
-/* 
- * mem_init - initialize the memory system model
+/*
+ * mem_init - initialize the default heap, emulating a very large heap
+ *            sparsely if sparse_mode is set
  */
-void mem_init(){
-    /* Dense allocation */
-    mmap_length = MAX_DENSE_HEAP;
+void mem_init(bool sparse_mode){
+    if (mem_file != NULL && !sparse_mode)
+        default_heap = mem_heap_open(mem_file, mem_max_heap);
+    else
+        default_heap = mem_heap_create(sparse_mode, mem_max_heap);
+    mem_set_limit(mem_limit);
+}
 
-    int dev_zero = open("/dev/zero", O_RDWR);
-    void *start = TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-                      mmap_length,  /* length */
-                      PROT_WRITE,   /* permissions */
-                      MAP_PRIVATE,  /* private or shared? */
-                      dev_zero,            /* fd */
-                      0);            /* offset */
-    if (addr == MAP_FAILED) {
-        fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
-        exit(1);
-    }
-    
-    heap = addr;
-    mem_max_addr = heap + MAX_DENSE_HEAP;
-    
-    stats_printed = false;
-    mem_brk = heap;
-    mem_reset_brk();
+/*
+ * mem_set_max_heap - set how many bytes the next dense heap set up by
+ *                    mem_init reserves, MAX_DENSE_HEAP by default
+ */
+void mem_set_max_heap(size_t bytes){
+    mem_max_heap = (bytes == 0) ? MAX_DENSE_HEAP : bytes;
+}
+
+/*
+ * mem_set_huge_pages - back dense heaps created from now on with huge
+ *                      pages: hugetlb pages if the system has enough
+ *                      set aside, or else transparent huge pages
+ */
+void mem_set_huge_pages(bool enable){
+    mem_huge = enable;
+}
+
+/*
+ * mem_set_file - keep dense default heaps set up from now on in the file
+ *                at path, or in anonymous memory again if path is NULL.
+ *                path must stay valid while it's in use.
+ */
+void mem_set_file(const char *path){
+    mem_file = path;
 }
 
-/* 
- * mem_deinit - free the storage used by the memory system model
+/*
+ * mem_deinit - free the storage used by the default heap
  */
 void mem_deinit(void){
-    print_stats();
-    munmap(heap, mmap_length);
+    mem_heap_destroy(default_heap);
+    default_heap = NULL;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_set_limit - cap the default heap at bytes, below its reservation,
+ *                 so that mem_sbrk runs out of memory early.  0 removes
+ *                 the cap.  The cap carries over to later calls of mem_init.
  */
-void mem_reset_brk(){
-    print_stats();
-    mem_brk = heap;
+void mem_set_limit(size_t bytes){
+    mem_limit = bytes;
+    if (default_heap != NULL)
+        mem_heap_set_limit(default_heap, bytes);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *                by incr bytes and returns the start address of the new area. In
- *                this model, the heap cannot be shrunk.
+/*
+ * The handle-less calls, each on the default heap
  */
 void *mem_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
-
-    bool ok = true;
-    if (incr < 0) {
-        ok = false;
-        fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
-        ok = false;
-        size_t alloc = mem_brk - heap + incr;
-        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
-    } else if (sbrk(incr) == (void*) -1) {
-        ok = false;
-        fprintf(stderr, "ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
-    }
-    if (ok) {
-        mem_brk += incr;
-        return (void *) old_brk;
+    return mem_heap_sbrk(default_heap, incr);
+}
+
+void *mem_sbrk_local(size_t incr) {
+    return mem_heap_sbrk_local(default_heap, incr);
+}
+
+void mem_reset_brk(){
+    mem_heap_reset(default_heap);
+}
+
+void *mem_heap_lo(){
+    return (void *) default_heap->start;
+}
+
+void *mem_heap_hi(){
+    return mem_heap_last(default_heap);
+}
+
+void *mem_zero_lo(){
+    return mem_heap_zero(default_heap);
+}
+
+size_t mem_heapsize() {
+    return mem_heap_size(default_heap);
+}
+
+size_t mem_peak_heapsize() {
+    return mem_heap_peak(default_heap);
+}
+
+size_t mem_resident(){
+    return mem_heap_resident(default_heap);
+}
+
+size_t mem_committed(){
+    return mem_heap_committed(default_heap);
+}
+
+mem_pages_t mem_pages(){
+    return mem_heap_pages(default_heap);
+}
+
+void mem_purge(void *addr, size_t len) {
+    mem_heap_purge(default_heap, addr, len);
+}
+
+bool mem_remap(void *dst, void *src, size_t len) {
+    return mem_heap_remap(default_heap, dst, src, len);
+}
+
+bool mem_sync(void) {
+    return mem_heap_sync(default_heap);
+}
+
+uint64_t mem_read(const void *addr, size_t len) {
+    return mem_heap_read(default_heap, addr, len);
+}
+
+void mem_write(void *addr, uint64_t val, size_t len) {
+    mem_heap_write(default_heap, addr, val, len);
+}
+
+/*
+ * mem_heap_create - set up a new, empty heap reserving max_heap bytes of
+ *                   address space, or MAX_DENSE_HEAP if max_heap is 0.
+ *                   A sparse heap reserves as much of MAX_SPARSE_HEAP as
+ *                   it can instead.
+ */
+mem_heap_t *mem_heap_create(bool sparse_mode, size_t max_heap){
+    mem_heap_t *h = calloc(1, sizeof(mem_heap_t));
+    if (h == NULL) {
+        fprintf(stderr, "FAILURE.  couldn't allocate heap state\n");
+        exit(1);
+    }
+    h->sparse = sparse_mode;
+    h->fd = -1;
+    h->commit_step = MEM_COMMIT_STEP;
+    if (h->sparse) {
+        sparse_init(h);
+    } else if (mem_huge) {
+        h->mmap_length = ((max_heap == 0) ? MAX_DENSE_HEAP : max_heap);
+        h->mmap_length = (h->mmap_length + HUGE_PAGE_SIZE - 1)
+                         & ~((size_t) HUGE_PAGE_SIZE - 1);
+        h->start = huge_reserve(h);
+        if (h->commit_step < HUGE_PAGE_SIZE)
+            h->commit_step = HUGE_PAGE_SIZE;
     } else {
-        errno = ENOMEM;
-        return (void *) -1;
+        /* Dense allocation: reserve address space only, and commit it
+           in MEM_COMMIT_STEP pieces as the break moves up.  Only the
+           first heap gets the suggested start. */
+        h->mmap_length = (max_heap == 0) ? MAX_DENSE_HEAP : max_heap;
+
+        void *start = TRY_DENSE_HEAP_START;
+        void *addr = mmap(start,          /* suggested start*/
+                          h->mmap_length, /* length */
+                          PROT_NONE,      /* permissions, until committed */
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                          -1,             /* fd */
+                          0);             /* offset */
+        if (addr == MAP_FAILED) {
+            fprintf(stderr, "FAILURE.  mmap couldn't reserve space for heap\n");
+            exit(1);
+        }
+        h->start = addr;
     }
+    h->max_addr = h->start + h->mmap_length;
+    h->commit = h->start;
+    h->brk = h->start;
+    h->fresh = h->start;
+    mem_heap_reset(h);
+    return h;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_heap_open - set up a heap of at most max_heap bytes, or
+ *                 MAX_DENSE_HEAP if max_heap is 0, kept in the file at
+ *                 path, which is created if need be.  The file is mapped
+ *                 shared at FILE_HEAP_START, so what the heap held when
+ *                 the last process let go of it is there again at the same
+ *                 addresses.  The break starts at the heap's start, and
+ *                 the caller decides how much of the file to take back
+ *                 with mem_heap_sbrk.  Only one file heap can be open.
  */
-void *mem_heap_lo(){
-    return (void *) heap;
+mem_heap_t *mem_heap_open(const char *path, size_t max_heap){
+    mem_heap_t *h = calloc(1, sizeof(mem_heap_t));
+    struct stat st;
+    void *addr;
+
+    if (h == NULL) {
+        fprintf(stderr, "FAILURE.  couldn't allocate heap state\n");
+        exit(1);
+    }
+    h->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (h->fd < 0 || fstat(h->fd, &st) != 0) {
+        fprintf(stderr, "FAILURE.  couldn't open heap file %s: %s\n",
+                path, strerror(errno));
+        exit(1);
+    }
+    h->commit_step = MEM_COMMIT_STEP;
+    h->mmap_length = (max_heap == 0) ? MAX_DENSE_HEAP : max_heap;
+
+    /* The file covers the whole reservation, sparsely, so no page
+       of the mapping lies past its end */
+    if ((size_t) st.st_size < h->mmap_length
+        && ftruncate(h->fd, (off_t) h->mmap_length) != 0) {
+        fprintf(stderr, "FAILURE.  couldn't size heap file %s: %s\n",
+                path, strerror(errno));
+        exit(1);
+    }
+    addr = mmap(FILE_HEAP_START, h->mmap_length, PROT_NONE,
+                MAP_SHARED | MAP_FIXED_NOREPLACE, h->fd, 0);
+    if (addr != FILE_HEAP_START) {
+        fprintf(stderr, "FAILURE.  couldn't map heap file %s at %p\n",
+                path, FILE_HEAP_START);
+        exit(1);
+    }
+    h->start = addr;
+    h->max_addr = h->start + h->mmap_length;
+    h->commit = h->start;
+    h->brk = h->start;
+    /* Only a file that was empty is known to read as zero */
+    h->fresh = (st.st_size == 0) ? h->start : h->max_addr;
+    mem_heap_reset(h);
+    return h;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_heap_destroy - free the storage used by a heap.  A file heap's
+ *                    contents stay in its file.
  */
-void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+void mem_heap_destroy(mem_heap_t *h){
+    print_stats(h);
+    if (h->sparse)
+        sparse_deinit(h);
+    munmap(h->start, h->mmap_length);
+    if (h->fd >= 0)
+        close(h->fd);
+    free(h);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heap_reset - reset a heap's break to make it empty
  */
-size_t mem_heapsize() {
-    return (size_t)(mem_brk - heap);
+void mem_heap_reset(mem_heap_t *h){
+    print_stats(h);
+    if (h->sparse) {
+        /* Pages given back read as zero again */
+        sparse_clear(h);
+        h->fresh = h->start;
+    }
+    h->brk = h->start;
+    h->peak = h->start;
+    __atomic_store_n(&h->epoch, __atomic_add_fetch(&mem_epochs, 1, __ATOMIC_RELAXED),
+                     __ATOMIC_RELEASE);
 }
 
 /*
- * mem_pagesize() - returns the page size of the system
+ * mem_heap_set_limit - cap a heap at bytes, below its reservation, so that
+ *                      mem_heap_sbrk runs out of memory early.  0 removes
+ *                      the cap.
  */
-size_t mem_pagesize(){
-    return (size_t) sysconf(_SC_PAGESIZE);
+void mem_heap_set_limit(mem_heap_t *h, size_t bytes){
+    if (bytes == 0 || bytes > h->mmap_length)
+        bytes = h->mmap_length;
+    h->max_addr = h->start + bytes;
 }
 
+/*
+ * mem_heap_sbrk - simple model of the sbrk function. Extends the heap
+ *                by incr bytes and returns the start address of the new area.
+ *                A negative incr shrinks the heap, giving the top -incr
+ *                bytes back.  Safe to call from several threads: the break
+ *                moves by compare-and-swap, so each caller gets its own area,
+ *                though not necessarily right after the one it got last.
+ */
+void *mem_heap_sbrk(mem_heap_t *h, intptr_t incr) {
+    unsigned char *old_brk = __atomic_load_n(&h->brk, __ATOMIC_RELAXED);
+    unsigned char *new_brk;
 
-/*************** Private Functions *******************/
+    do {
+        if (incr < 0 && (size_t) -incr > (size_t)(old_brk - h->start)) {
+            fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to shrink heap by %ld bytes, below its start\n", (long) -incr);
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        if (incr > 0 && old_brk + incr > h->max_addr) {
+            size_t alloc = old_brk - h->start + incr;
+            fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        new_brk = old_brk + incr;
+    } while (!__atomic_compare_exchange_n(&h->brk, &old_brk, new_brk, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    if (incr > 0) {
+        if (!h->sparse && !commit_to(h, new_brk)) {
+            /* Give the area back, unless another thread is above it */
+            __atomic_compare_exchange_n(&h->brk, &new_brk, old_brk, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            fprintf(stderr, "ERROR: mem_sbrk failed.  Could not commit more heap space\n");
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        raise_to(&h->fresh, new_brk);
+        raise_to(&h->peak, new_brk);
+    } else if (incr < 0 && !h->sparse) {
+        decommit_from(h, new_brk);
+    }
+    return (void *) old_brk;
+}
 
+/*
+ * mem_heap_sbrk_local - like mem_heap_sbrk for incr > 0, but carves the
+ *                  area out of a chunk of at least MEM_LOCAL_CHUNK bytes
+ *                  that the calling thread reserved earlier, so threads
+ *                  that extend often don't all fight over the break.  incr
+ *                  must be a multiple of 16.  What's left of a thread's
+ *                  chunk is dropped when it needs a new one, the heap is
+ *                  emptied, or it asks another heap.
+ */
+void *mem_heap_sbrk_local(mem_heap_t *h, size_t incr) {
+    unsigned long epoch = __atomic_load_n(&h->epoch, __ATOMIC_ACQUIRE);
+    unsigned char *area;
 
-static void print_stats() {
-    size_t vbytes = mem_heapsize();
-    if (!show_stats || vbytes == 0 || stats_printed)
-        return;
-    printf("Allocated %zu heap bytes.  Max address = %p\n",
-           vbytes, mem_brk);
-    stats_printed = true;
+    if (local_epoch != epoch || (size_t)(local_end - local_next) < incr) {
+        size_t chunk = (incr > MEM_LOCAL_CHUNK) ? incr : MEM_LOCAL_CHUNK;
+        if ((area = mem_heap_sbrk(h, (intptr_t) chunk)) == (void *) -1)
+            return (void *) -1;
+        local_next = area;
+        local_end = area + chunk;
+        local_epoch = epoch;
+    }
+    area = local_next;
+    local_next += incr;
+    return (void *) area;
 }
 
-uint64_t mem_read(const void *addr, size_t len) {
+/*
+ * mem_heap_first - return address of the first heap byte
+ */
+void *mem_heap_first(mem_heap_t *h){
+    return (void *) h->start;
+}
+
+/*
+ * mem_heap_last - return address of last heap byte
+ */
+void *mem_heap_last(mem_heap_t *h){
+    return (void *)(__atomic_load_n(&h->brk, __ATOMIC_ACQUIRE) - 1);
+}
+
+/*
+ * mem_heap_zero - return the lowest address that no mem_heap_sbrk since
+ *                 the heap was created has handed out.  The heap is still
+ *                 zero from there on, even after mem_heap_reset.
+ */
+void *mem_heap_zero(mem_heap_t *h){
+    return (void *) __atomic_load_n(&h->fresh, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * mem_heap_size - returns the heap size in bytes
+ */
+size_t mem_heap_size(mem_heap_t *h) {
+    return (size_t)(__atomic_load_n(&h->brk, __ATOMIC_ACQUIRE) - h->start);
+}
+
+/*
+ * mem_heap_peak - returns the largest the heap has been since the
+ *                 last mem_heap_reset, in bytes
+ */
+size_t mem_heap_peak(mem_heap_t *h) {
+    return (size_t)(h->peak - h->start);
+}
+
+/*
+ * mem_heap_purge - give the whole pages of [addr, addr+len) back to the
+ *                  system.  They stay part of heap h, and read back as zero.
+ */
+void mem_heap_purge(mem_heap_t *h, void *addr, size_t len){
+    size_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t) addr + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t) addr + len) & ~(page - 1);
+    /* Shared file pages only read as zero once removed from the file */
+    int advice = h->fd >= 0 ? MADV_REMOVE : MADV_DONTNEED;
+    if (hi > lo)
+        madvise((void *) lo, hi - lo, advice);
+}
+
+/*
+ * mem_heap_remap - move the pages of [src, src+len) to dst without copying
+ *                  them, by remapping.  dst, src and len must be page
+ *                  aligned, and both ranges committed parts of the heap
+ *                  that don't overlap.  The pages that were at dst go to
+ *                  src, so nothing has to be faulted in again, and src
+ *                  holds what dst held.  Returns false, with nothing moved,
+ *                  if the heap can't remap, and then the caller has to copy.
+ */
+bool mem_heap_remap(mem_heap_t *h, void *dst, void *src, size_t len){
+    void *spare;
+
+    /* Moving a file heap's pages would scramble the file */
+    if (h->sparse || h->pages == MEM_PAGES_HUGETLB || h->fd >= 0)
+        return false;
+
+    /* Park dst's pages in a spare range, move src's pages into their
+       place, and put the parked pages where src's were */
+    spare = mmap(NULL, len, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (spare == MAP_FAILED)
+        return false;
+    if (!move_pages(spare, dst, len)) {
+        munmap(spare, len);
+        return false;
+    }
+    if (!move_pages(dst, src, len) || !move_pages(src, spare, len)) {
+        fprintf(stderr, "FAILURE.  mremap failed partway through moving heap pages\n");
+        exit(1);
+    }
+    return true;
+}
+
+/*
+ * mem_heap_sync - write a file heap's committed pages back to its file,
+ *                 returning false if that failed.  Other heaps have
+ *                 nothing to write.
+ */
+bool mem_heap_sync(mem_heap_t *h){
+    unsigned char *commit = __atomic_load_n(&h->commit, __ATOMIC_ACQUIRE);
+
+    if (h->fd < 0 || commit == h->start)
+        return true;
+    return msync(h->start, commit - h->start, MS_SYNC) == 0;
+}
+
+/*
+ * mem_heap_resident - returns the number of heap bytes resident in memory
+ */
+size_t mem_heap_resident(mem_heap_t *h){
+    size_t page = mem_pagesize();
+    if (h->sparse) {
+        /* Only materialized pages can be resident */
+        size_t resident = 0;
+        unsigned char vec[1];
+        uint32_t i;
+        for (i = 1; i <= h->sparse_used; i++)
+            if (mincore(h->start + h->sparse_nodes[i].page * h->sparse_page,
+                        h->sparse_page, vec) == 0 && (vec[0] & 1))
+                resident += h->sparse_page;
+        return resident;
+    }
+    size_t pages = (mem_heap_size(h) + page - 1) / page;
+    size_t resident = 0;
+    size_t i, j, n;
+    unsigned char vec[1024];
+
+    for (i = 0; i < pages; i += n) {
+        n = (pages - i < sizeof(vec)) ? pages - i : sizeof(vec);
+        if (mincore(h->start + i * page, n * page, vec) != 0)
+            return 0;
+        for (j = 0; j < n; j++)
+            resident += vec[j] & 1;
+    }
+    return resident * page;
+}
+
+/*
+ * mem_heap_committed - returns the number of heap bytes committed, that
+ *                      is, that may be touched and so may count against
+ *                      memory
+ */
+size_t mem_heap_committed(mem_heap_t *h){
+    if (h->sparse)
+        return (size_t) h->sparse_used * h->sparse_page;
+    return (size_t)(__atomic_load_n(&h->commit, __ATOMIC_ACQUIRE) - h->start);
+}
+
+/*
+ * mem_heap_pages - returns the kind of pages backing a heap
+ */
+mem_pages_t mem_heap_pages(mem_heap_t *h){
+    return h->pages;
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(){
+    return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+/* Read len bytes of heap h and return value zero-extended to 64 bits */
+uint64_t mem_heap_read(mem_heap_t *h, const void *addr, size_t len) {
     uint64_t rdata;
 
+    /* A page never touched holds zero, and a read mustn't spill
+       into the next page, which may not exist */
+    if (h->sparse) {
+        if (!sparse_lookup(h, ((unsigned char *) addr - h->start) / h->sparse_page))
+            return 0;
+        rdata = 0;
+        memcpy(&rdata, addr, len);
+        return rdata;
+    }
     rdata = *(uint64_t *) addr;
     if (len < sizeof(uint64_t)) {
         uint64_t mask = ((uint64_t) 1 << (8 * len)) - 1;
@@ -154,10 +609,286 @@ uint64_t mem_read(const void *addr, size_t len) {
     return rdata;
 }
 
-/* Write lower order len bytes of val to address */
-void mem_write(void *addr, uint64_t val, size_t len) {
+/* Write lower order len bytes of val to address in heap h */
+void mem_heap_write(mem_heap_t *h, void *addr, uint64_t val, size_t len) {
+   if (h->sparse) {
+        uint64_t page = ((unsigned char *) addr - h->start) / h->sparse_page;
+        if (!sparse_lookup(h, page))
+            sparse_materialize(h, page);
+   }
    if (len == sizeof(uint64_t))
         *(uint64_t *) addr = val;
     else
         memcpy(addr, (void *) &val, len);
 }
+
+
+/*************** Private Functions *******************/
+
+/*
+ * raise_to - move a high-water mark up to addr, unless another thread
+ *            already moved it further
+ */
+static void raise_to(unsigned char **mark, unsigned char *addr) {
+    unsigned char *old = __atomic_load_n(mark, __ATOMIC_RELAXED);
+    while (old < addr
+           && !__atomic_compare_exchange_n(mark, &old, addr, true,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        ;
+}
+
+
+static void print_stats(mem_heap_t *h) {
+    size_t vbytes = mem_heap_size(h);
+    if (!show_stats || vbytes == 0 || h->stats_printed)
+        return;
+    printf("Allocated %zu heap bytes.  Max address = %p\n",
+           vbytes, h->brk);
+    h->stats_printed = true;
+}
+
+/*
+ * commit_to - make the heap readable and writable up to at least addr,
+ *             in whole commit steps.  Returns false if the
+ *             system is out of memory.
+ */
+static bool commit_to(mem_heap_t *h, unsigned char *addr) {
+    unsigned char *old = __atomic_load_n(&h->commit, __ATOMIC_ACQUIRE);
+    unsigned char *end;
+
+    if (addr <= old)
+        return true;
+    end = h->start + (((size_t)(addr - h->start) + h->commit_step - 1)
+                      & ~(h->commit_step - 1));
+    if (end > h->start + h->mmap_length)
+        end = h->start + h->mmap_length;
+    /* Threads racing here commit overlapping ranges, which is harmless */
+    if (mprotect(old, end - old, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    raise_to(&h->commit, end);
+    return true;
+}
+
+/*
+ * decommit_from - give back the committed steps wholly above addr, which
+ *                 read as zero once committed again.  Only for a heap
+ *                 that one thread is shrinking.
+ */
+static void decommit_from(mem_heap_t *h, unsigned char *addr) {
+    unsigned char *end = h->start + (((size_t)(addr - h->start) + h->commit_step - 1)
+                                     & ~(h->commit_step - 1));
+    if (end >= h->commit)
+        return;
+    madvise(end, h->commit - end, (h->fd >= 0) ? MADV_REMOVE : MADV_DONTNEED);
+    mprotect(end, h->commit - end, PROT_NONE);
+    __atomic_store_n(&h->commit, end, __ATOMIC_RELEASE);
+}
+
+/*
+ * move_pages - remap [src, src+len) to dst.  mremap only moves a range
+ *              inside one mapping, and earlier moves leave the heap in
+ *              many, so a range that straddles two is split in halves.
+ *              A failure other than that may leave some pages moved.
+ */
+static bool move_pages(unsigned char *dst, unsigned char *src, size_t len) {
+    size_t page = mem_pagesize();
+    size_t half;
+
+    if (mremap(src, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, dst) != MAP_FAILED)
+        return true;
+    if (errno != EFAULT || len <= page)
+        return false;
+    half = (len / 2) & ~(page - 1);
+    return move_pages(dst, src, half)
+           && move_pages(dst + half, src + half, len - half);
+}
+
+/*
+ * huge_reserve - reserve a heap of h->mmap_length bytes on a huge-page
+ *                boundary.  Tries hugetlb pages first, which fails unless
+ *                the system set enough of them aside, and falls back to
+ *                ordinary pages that the kernel may gather into
+ *                transparent huge pages.
+ */
+static void *huge_reserve(mem_heap_t *h) {
+    unsigned char *addr, *start;
+    size_t slack;
+
+    addr = mmap(NULL, h->mmap_length, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+        h->pages = MEM_PAGES_HUGETLB;
+        return addr;
+    }
+
+    /* Over-reserve by a huge page, and trim both ends to align */
+    addr = mmap(NULL, h->mmap_length + HUGE_PAGE_SIZE, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "FAILURE.  mmap couldn't reserve space for heap\n");
+        exit(1);
+    }
+    start = (unsigned char *)(((uintptr_t) addr + HUGE_PAGE_SIZE - 1)
+                              & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+    if (start > addr)
+        munmap(addr, start - addr);
+    slack = HUGE_PAGE_SIZE - (start - addr);
+    if (slack > 0)
+        munmap(start + h->mmap_length, slack);
+    h->pages = (madvise(start, h->mmap_length, MADV_HUGEPAGE) == 0)
+               ? MEM_PAGES_THP : MEM_PAGES_BASE;
+    return start;
+}
+
+/*
+ * sparse_init - reserve the emulated heap, as much of MAX_SPARSE_HEAP as
+ *               the address space allows, and set up the page table.
+ *               The first sparse heap installs sparse_fault.
+ */
+static void sparse_init(mem_heap_t *h) {
+    struct sigaction action;
+    size_t buckets;
+    void *addr = MAP_FAILED;
+
+    h->sparse_page = mem_pagesize();
+    if (h->sparse_page < SPARSE_PAGE_SIZE)
+        h->sparse_page = SPARSE_PAGE_SIZE;
+    for (h->mmap_length = MAX_SPARSE_HEAP; h->mmap_length >= MAX_DENSE_HEAP;
+         h->mmap_length >>= 1) {
+        addr = mmap(SPARSE_HEAP_START, h->mmap_length, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr != MAP_FAILED)
+            break;
+    }
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "FAILURE.  mmap couldn't reserve space for sparse heap\n");
+        exit(1);
+    }
+    h->start = addr;
+
+    /* Enough buckets to keep chains at HASH_LOAD nodes on average */
+    for (h->sparse_bits = 0, buckets = 1;
+         buckets * HASH_LOAD < MAX_SPARSE_PAGES; h->sparse_bits++)
+        buckets <<= 1;
+    h->sparse_nodes = mmap(NULL, (MAX_SPARSE_PAGES + 1) * sizeof(sparse_node_t),
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    h->sparse_buckets = mmap(NULL, buckets * sizeof(uint32_t),
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (h->sparse_nodes == MAP_FAILED || h->sparse_buckets == MAP_FAILED) {
+        fprintf(stderr, "FAILURE.  mmap couldn't allocate sparse page table\n");
+        exit(1);
+    }
+    h->sparse_used = 0;
+    h->sparse_last = UINT64_MAX;
+
+    if (sparse_heaps == NULL) {
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = sparse_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &old_segv);
+    }
+    h->sparse_next = sparse_heaps;
+    sparse_heaps = h;
+}
+
+/*
+ * sparse_deinit - free the page table, and once no sparse heap is left,
+ *                 put back the old fault handler
+ */
+static void sparse_deinit(mem_heap_t *h) {
+    size_t buckets = (size_t) 1 << h->sparse_bits;
+    mem_heap_t **link;
+
+    for (link = &sparse_heaps; *link != h; link = &(*link)->sparse_next)
+        ;
+    *link = h->sparse_next;
+    if (sparse_heaps == NULL)
+        sigaction(SIGSEGV, &old_segv, NULL);
+    munmap(h->sparse_nodes, (MAX_SPARSE_PAGES + 1) * sizeof(sparse_node_t));
+    munmap(h->sparse_buckets, buckets * sizeof(uint32_t));
+}
+
+/*
+ * sparse_clear - give back every materialized page, and empty the table
+ */
+static void sparse_clear(mem_heap_t *h) {
+    uint32_t i;
+    int shift = 64 - h->sparse_bits;
+    for (i = 1; i <= h->sparse_used; i++) {
+        uint64_t page = h->sparse_nodes[i].page;
+        unsigned char *addr = h->start + page * h->sparse_page;
+        madvise(addr, h->sparse_page, MADV_DONTNEED);
+        mprotect(addr, h->sparse_page, PROT_NONE);
+        h->sparse_buckets[(page * 0x9E3779B97F4A7C15ULL) >> shift] = 0;
+    }
+    h->sparse_used = 0;
+    h->sparse_last = UINT64_MAX;
+}
+
+/*
+ * sparse_lookup - has the given page been materialized?
+ */
+static bool sparse_lookup(mem_heap_t *h, uint64_t page) {
+    uint32_t i;
+
+    if (page == h->sparse_last)
+        return true;
+    i = h->sparse_buckets[(page * 0x9E3779B97F4A7C15ULL) >> (64 - h->sparse_bits)];
+    for (; i != 0; i = h->sparse_nodes[i].next) {
+        if (h->sparse_nodes[i].page == page) {
+            h->sparse_last = page;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * sparse_materialize - make a page readable and writable, and record it.
+ *                      Called from sparse_fault, so it avoids stdio.
+ */
+static void sparse_materialize(mem_heap_t *h, uint64_t page) {
+    static const char full[] = "ERROR: sparse heap has too many pages\n";
+    uint32_t *bucket;
+
+    if (h->sparse_used == MAX_SPARSE_PAGES) {
+        if (write(STDERR_FILENO, full, sizeof(full) - 1) < 0)
+            _exit(1);
+        _exit(1);
+    }
+    mprotect(h->start + page * h->sparse_page, h->sparse_page,
+             PROT_READ | PROT_WRITE);
+    bucket = &h->sparse_buckets[(page * 0x9E3779B97F4A7C15ULL) >> (64 - h->sparse_bits)];
+    h->sparse_used++;
+    h->sparse_nodes[h->sparse_used].page = page;
+    h->sparse_nodes[h->sparse_used].next = *bucket;
+    *bucket = h->sparse_used;
+    h->sparse_last = page;
+}
+
+/*
+ * sparse_fault - materialize a page of a sparse heap that the allocator
+ *                touched for the first time.  Other faults go to the old
+ *                handler.
+ */
+static void sparse_fault(int sig, siginfo_t *info, void *context) {
+    unsigned char *addr = info->si_addr;
+    mem_heap_t *h;
+
+    for (h = sparse_heaps; h != NULL; h = h->sparse_next) {
+        if (addr >= h->start && addr < h->brk) {
+            uint64_t page = (addr - h->start) / h->sparse_page;
+            if (!sparse_lookup(h, page)) {
+                sparse_materialize(h, page);
+                return;
+            }
+        }
+    }
+    /* Not ours: fault again with the old handler */
+    sigaction(SIGSEGV, &old_segv, NULL);
+    (void) sig;
+    (void) context;
+}
@@ -2,14 +2,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void mem_init();               
+/* Pages backing a heap: the system's base pages, base pages that the
+   kernel may merge into transparent huge pages, or hugetlb pages */
+typedef enum {
+    MEM_PAGES_BASE,
+    MEM_PAGES_THP,
+    MEM_PAGES_HUGETLB
+} mem_pages_t;
+
+void mem_init(bool sparse_mode);
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+void *mem_sbrk_local(size_t incr);
 void mem_reset_brk(void); 
+void mem_set_limit(size_t bytes);
+void mem_set_max_heap(size_t bytes);
+void mem_set_huge_pages(bool enable);
+void mem_set_file(const char *path);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_zero_lo(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
+void mem_purge(void *addr, size_t len);
+bool mem_remap(void *dst, void *src, size_t len);
+bool mem_sync(void);
+size_t mem_resident(void);
+size_t mem_committed(void);
+mem_pages_t mem_pages(void);
 
 /* Read len bytes and return value zero-extended to 64 bits */
 /* Require 0 <= len <= 8 */
@@ -18,3 +39,28 @@ uint64_t mem_read(const void *addr, size_t len);
 /* Write lower order len bytes of val to address */
 /* Require 0 <= len <= 8 */
 void mem_write(void *addr, uint64_t val, size_t len);
+
+/* Independent heaps.  The calls above work on the default heap,
+   which mem_init creates and mem_deinit destroys. */
+typedef struct mem_heap mem_heap_t;
+
+mem_heap_t *mem_heap_create(bool sparse_mode, size_t max_heap);
+mem_heap_t *mem_heap_open(const char *path, size_t max_heap);
+void mem_heap_destroy(mem_heap_t *h);
+void *mem_heap_sbrk(mem_heap_t *h, intptr_t incr);
+void *mem_heap_sbrk_local(mem_heap_t *h, size_t incr);
+void mem_heap_reset(mem_heap_t *h);
+void mem_heap_set_limit(mem_heap_t *h, size_t bytes);
+void *mem_heap_first(mem_heap_t *h);
+void *mem_heap_last(mem_heap_t *h);
+void *mem_heap_zero(mem_heap_t *h);
+size_t mem_heap_size(mem_heap_t *h);
+size_t mem_heap_peak(mem_heap_t *h);
+size_t mem_heap_resident(mem_heap_t *h);
+size_t mem_heap_committed(mem_heap_t *h);
+mem_pages_t mem_heap_pages(mem_heap_t *h);
+void mem_heap_purge(mem_heap_t *h, void *addr, size_t len);
+bool mem_heap_remap(mem_heap_t *h, void *dst, void *src, size_t len);
+bool mem_heap_sync(mem_heap_t *h);
+uint64_t mem_heap_read(mem_heap_t *h, const void *addr, size_t len);
+void mem_heap_write(mem_heap_t *h, void *addr, uint64_t val, size_t len);
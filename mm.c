@@ -47,6 +47,13 @@
 
 /* You can change anything from here onward */
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
 /*
  * If DEBUG is defined, enable printing on dbg_printf and contracts.
  * Debugging macros, with names beginning "dbg_" are allowed.
@@ -89,6 +96,17 @@ static const size_t chunksize = (1 << 12);    // requires (chunksize % 16 == 0)
 
 static const word_t alloc_mask = 0x1;
 static const word_t size_mask = ~(word_t)0xF;
+//Set on free blocks whose payload is known to be zero,
+//apart from their free-list links, purge stamp and footer
+static const word_t zero_mask = 0x8;
+//Set on allocated blocks reserved with MM_GROW, whose slack realloc
+//keeps; it shares its bit with zero_mask, which only free blocks carry
+static const word_t grow_mask = 0x8;
+//Set on free blocks whose interior pages have been purged
+static const word_t purged_mask = 0x4;
+//Set, with the alloc bit, on slab objects; heap blocks only
+//carry this bit while they are free, as purged_mask
+static const word_t slab_mask = 0x4;
 
 typedef struct block block_t;
 
@@ -110,6 +128,9 @@ typedef struct block
 
         } block_ties;
 
+        //Slot of a free block in its side-table class (side-table mode only)
+        size_t side_index;
+
         char payload[0];
     
     } block_payload;
@@ -126,13 +147,342 @@ typedef struct block
 /* Global variables */
 /* Pointer to first block */
 static block_t *heap_start = NULL;
+/* Pointer to the epilogue header */
+static block_t *heap_end = NULL;
 //This represents an array of pointers where blocks of memory will be placed.
 static block_t *segregrated_list[12]; 
 
+/*
+ * Side-table metadata. Instead of threading free blocks through the
+ * segregated lists, each size class keeps a contiguous array of
+ * (size, offset) records, both in 16-byte units, so a fit search streams
+ * through one array rather than chasing pointers into the heap.
+ * If a class fills up, or a block does not fit the 32-bit records,
+ * the table spills back into the segregated lists for the rest of the run.
+ * The arrays are mapped by the first mm_init that asks for them, so other
+ * heaps pay nothing for them, and only the pages records reach get touched.
+ */
+//Number of records each size class can hold in the side table
+#define side_capacity (1 << 14)
+//Number of records compared per fit-search window
+static const size_t side_window = 64;
+//Largest size or offset (in 16-byte units) a record can hold
+static const size_t side_limit = INT32_MAX - 1;
+
+static bool side_table = false;  //Requested through mm_set_side_table
+static bool side_active = false; //Side table holds the free blocks of this heap
+static uint32_t (*side_sizes)[side_capacity] = NULL;   //Mapped by side_map
+static uint32_t (*side_offsets)[side_capacity] = NULL;
+static size_t side_count[seg_size];
+
+//Compare kernel picked in mm_init: AVX2, SSE2 or scalar
+typedef size_t (*side_kernel_t)(const uint32_t *sizes, size_t n, uint32_t need);
+static side_kernel_t side_best = NULL;
+
+/*
+ * Exact-size cache. A small open-addressed table maps an exact block size
+ * to a LIFO stack of freed blocks of that size. free pushes onto the stack
+ * instead of coalescing, and malloc pops from it before calling find_fit,
+ * so repeated sizes are reused in O(1) without splitting. Cached blocks
+ * stay marked allocated in the heap; the stack is linked through their
+ * next pointers. A slot is given up when its stack empties, and sizes too
+ * large to cache skip the lookup altogether. When the hit rate over a
+ * window drops too low, the cache is flushed back into the heap and
+ * switched off for the rest of the run.
+ */
+//Number of slots in the table (a power of 2)
+#define exact_slots 32
+//Slots probed before giving up on a size
+static const size_t exact_probe = 4;
+//Most blocks cached for a single size
+static const size_t exact_depth = 64;
+//Largest block size that is cached
+static const size_t exact_max_size = 1024;
+//Lookups per hit-rate check, and the hits needed to stay enabled
+static const size_t exact_window = 4096;
+static const size_t exact_min_hits = 512;
+
+typedef struct {
+    size_t size;  //Block size held by this slot, 0 if unused
+    block_t *top; //Most recently cached block
+    size_t count; //Number of blocks on the stack
+} exact_slot_t;
+
+static bool exact_cache = false;  //Requested through mm_set_exact_cache
+static bool exact_active = false; //Cache is in use for this heap
+static exact_slot_t exact_table[exact_slots];
+static size_t exact_lookups;      //malloc lookups since mm_init
+static size_t exact_hits;         //lookups served from the cache
+static size_t exact_window_lookups;
+static size_t exact_window_hits;
+
+/*
+ * Cache coloring. Same-size blocks carved from fresh heap chunks would all
+ * start at the same offsets within their pages, and so map to the same
+ * cache sets. With coloring on, each new run of small blocks starts
+ * color_line bytes further into its chunk than the last run of that size
+ * class did, cycling through color_count colors. The skipped bytes stay
+ * behind as an ordinary free block.
+ */
+static const size_t color_line = 64;     //Cache line size (bytes)
+static const size_t color_count = 8;     //Number of run start offsets
+static const size_t color_max_size = 256; //Largest block size that is colored
+
+static bool coloring = false;            //Requested through mm_set_coloring
+static size_t color_next[seg_size];      //Next color of each size class
+
+/*
+ * Huge-page placement. A block of a huge page or more gets a payload
+ * starting on a huge-page boundary, so it spans as few huge pages, and
+ * so TLB entries, as it can. The bytes skipped in front stay behind as
+ * an ordinary free block. Off in compact mode.
+ */
+static const size_t huge_size = 1 << 21; //Huge page size (bytes)
+
+static bool huge_align = false;          //Requested through mm_set_huge_align
+
+/*
+ * Page remapping. Blocks of remap_min_size or more get page-aligned
+ * payloads, so when realloc moves one its old and new payloads share
+ * their offset in a page, and memlib swaps the whole pages between them
+ * instead of realloc copying their bytes. The fronts split off to align
+ * the blocks fill with small blocks that keep large free blocks apart,
+ * so this trades space for the copies.
+ */
+static const size_t remap_min_size = 1 << 20; //Smallest block remapped
+
+static bool remapping = false;           //Requested through mm_set_remap
+static size_t remapped_bytes;            //Bytes remapped since mm_init
+
+/*
+ * Lifetime-segregated placement. A sample of blocks is timed from malloc
+ * to free, counting malloc and free calls, and each size class keeps a
+ * running average of the lifetimes seen. Blocks of classes whose average
+ * is far below that of all blocks are predicted to die young, and placed
+ * in the nursery: a region of the heap fenced off by two allocated blocks,
+ * so it never coalesces with its neighbours, with its own segregated
+ * lists. Short-lived blocks then stop pinning pages among the long-lived
+ * ones, and the nursery empties again quickly. The nursery starts small.
+ * When it fills with live blocks, rather than with holes, it is handed
+ * back to the heap for a new one twice the size, so it grows to the
+ * short-lived demand the program shows. An empty nursery is handed back
+ * too before the heap grows, and made again, the same size, wherever there
+ * is room the next time it is needed.
+ */
+//Slots in the table of sampled blocks (a power of 2)
+#define life_table_size 1024
+static const size_t life_sample_rate = 4;      //Sample one in this many mallocs
+static const size_t life_min_samples = 32;     //Samples needed to predict
+static const size_t life_short_ratio = 32;     //How much shorter than all blocks
+static const size_t nursery_min_size = (1 << 12); //Least bytes in a nursery
+
+typedef struct {
+    block_t *block; //Sampled block, NULL if the slot is unused
+    size_t born;    //Value of life_clock when it was allocated
+    int index;      //Size class it was allocated for
+} life_sample_t;
+
+static bool lifetime = false;           //Requested through mm_set_lifetime
+static size_t life_clock;               //Number of malloc and free calls
+static life_sample_t life_table[life_table_size];
+static size_t life_avg[seg_size];       //Average lifetime of a class, times 8
+static size_t life_avg_all;             //Slower average of all classes, times 64
+static size_t life_samples[seg_size];   //Lifetimes seen for each class
+static block_t *nursery_list[seg_size]; //Free blocks inside the nursery
+static char *nursery_lo = NULL;         //Start of the nursery, NULL if none
+static char *nursery_hi = NULL;         //End of the nursery
+static size_t nursery_next;             //Bytes in the next nursery made
+static size_t nursery_live;             //Bytes allocated in the nursery
+static size_t nursery_allocs;           //Blocks placed in the nursery
+static size_t life_allocs;              //Blocks placed in all
+
+/*
+ * Allocation hints. mm_malloc_flags sends each hint down its own path.
+ * MM_ZERO prefers free blocks still zero from a fresh heap extension,
+ * which only need their link and footer words cleared. MM_LONG_LIVED
+ * and MM_NO_SPLIT search for the best fit instead of the first one,
+ * MM_GROW allocates twice the size and marks the block so realloc keeps
+ * the slack, which it splits off other blocks that shrink, and
+ * MM_ALIGN_LINE splits off a leading free block to line-align the payload.
+ */
+static const size_t zero_scan = 16;  //Blocks looked at per class for a zero fit
+static const size_t align_scan = 25; //Fits compared per class for an aligned fit
+
+/*
+ * Soft heap limit. Until the heap would grow past the limit, or memlib
+ * runs out of memory, the allocator favours throughput: the exact-size
+ * cache, first fits, coloring pads, the nursery and over-provisioned
+ * reallocs. From then on it runs in compact mode: the cache is flushed,
+ * fits are exact best fits, reallocs move rather than keep slack, the heap
+ * only grows by what its tail free block lacks, and free trims the heap.
+ */
+static size_t soft_limit = 0;        //Requested through mm_set_soft_limit
+static size_t heap_limit = 0;        //Soft limit of this heap, 0 for none
+static bool compact = false;         //Heap has switched to compact mode
+
+/*
+ * Page purging. Free blocks of at least purge_min_size bytes are stamped
+ * with the number of free calls so far when they go on a free list.
+ * Every purge_interval frees, the blocks that have stayed free for
+ * purge_delay frees hand their interior pages back to the system, and
+ * are marked purged: those pages read back as zero until the block's
+ * header is rewritten. The delay keeps blocks that are reused quickly
+ * from being purged and faulted back in over and over.
+ */
+static const size_t purge_min_size = (1 << 14); //Smallest block purged
+static const size_t purge_interval = 256;       //Frees between purge passes
+static const size_t purge_delay = 1024;         //Frees a block stays free first
+
+static bool purging = false;         //Requested through mm_set_purging
+static size_t purge_clock;           //Number of free calls
+static size_t purged_bytes;          //Bytes purged since mm_init
+static size_t page_size;             //System page size
+
+/*
+ * Background maintenance. With a worker running, free only puts blocks
+ * the exact-size cache doesn't take on a pending list, still marked
+ * allocated, and the worker coalesces them into the heap in batches.
+ * It also runs the purge passes and trims a large free tail off the
+ * heap, so none of that work lands on a caller's malloc or free.
+ * Every entry point holds the heap lock while a worker runs; the worker
+ * takes it for one short step at a time. malloc drains the pending
+ * list itself before growing the heap, so deferred blocks still count.
+ */
+static const size_t maint_batch = 64;          //Pending blocks per step
+static const size_t maint_pending_max = 4096;  //Pending blocks before free
+                                               //coalesces inline again
+static const size_t maint_trim_size = (1 << 16); //Tail the worker trims
+static const long maint_period_ns = 1000000;   //Worker sleep between passes
+
+static bool background = false;        //Requested through mm_set_background
+static bool maint_running = false;     //A worker thread is running
+static bool maint_stop = false;        //Tells the worker to exit
+static pthread_t maint_thread;
+static block_t *maint_pending = NULL;  //Freed blocks not yet coalesced
+static size_t maint_pending_count;
+
+/*
+ * Lock-free slabs. With slabs on, blocks of the slab_classes smallest
+ * sizes (32, 48 and 64 bytes) come from slab pages: slab_page_size
+ * blocks carved from the heap into objects of one size. The first payload
+ * word of a page names its class. Each object has a header word holding
+ * its offset into the page, slab_mask and the alloc bit, so free can
+ * tell it from a heap block. The free objects of a class sit on a
+ * Treiber stack whose head packs the top object's address into its low
+ * 48 bits and a tag, bumped by every push and pop, into the high 16, so
+ * a compare-and-swap against a stale head fails rather than suffer ABA.
+ * Only carving a new page takes the heap lock.
+ */
+#define slab_classes 3
+static const size_t slab_page_size = (1 << 14);   //Bytes in a slab page
+static const int slab_tag_shift = 48;             //Tag bits above the address
+static const uint64_t slab_ptr_mask = ((uint64_t)1 << 48) - 1;
+
+static bool slab = false;              //Requested through mm_set_slab
+static bool slab_active = false;       //Slabs serve small blocks of this heap
+static uint64_t slab_heads[slab_classes]; //Tagged free-object stack heads
+static size_t slab_pages;              //Pages carved since mm_init
+
+/*
+ * Owned slab heaps. With owned heaps on, each thread carves its own slab
+ * pages, and the page's first word holds the owner's address with the
+ * class in the low bits. The owner pops and pushes its free objects
+ * with plain loads and stores. Another thread freeing one of them pushes
+ * it on the owner's remote stack with a single CAS, and the owner takes
+ * the whole stack with one exchange at its next malloc and sorts it back
+ * into its own lists. Since the owner never pops one object at a time
+ * off the remote stack, that stack needs no tag. Pages of a thread that
+ * exits stay with its owner, which is marked idle as the thread goes;
+ * the next thread to need an owner adopts an idle one, lists, pages,
+ * remote stack and all, before making a new one. Objects freed to a
+ * thread that is still running but never mallocs again stay on its
+ * remote stack until it does, or until the next mm_init.
+ */
+typedef struct slab_owner {
+    block_t *local[slab_classes];      //Free objects only the owner touches
+    block_t *remote;                   //Objects other threads freed
+    size_t remote_frees;               //Objects the owner drained
+    bool idle;                         //Its thread exited
+    struct slab_owner *next;           //All owners of the heap
+} slab_owner_t;
+
+static bool owned = false;             //Requested through mm_set_owned_heaps
+static bool owned_active = false;      //Threads own the slabs of this heap
+static slab_owner_t *slab_owners;      //Owners since mm_init
+static unsigned heap_epoch;            //Bumped by every mm_init
+static bool owner_key_ready = false;   //owner_key created
+static pthread_key_t owner_key;        //Runs owner_exit as a thread exits
+static __thread slab_owner_t *thread_owner;
+static __thread unsigned thread_epoch; //heap_epoch of thread_owner
+
+/*
+ * Fine-grained locks. With fine locks on, malloc and free take a lock
+ * per size class rather than one heap lock. malloc searches each class
+ * under its own lock and marks the block it takes allocated before
+ * letting go, so a neighbour being freed sees it as in use. Changing
+ * block boundaries, by splitting, coalescing or freeing, happens under
+ * fine_boundary, and a boundary holder takes the lock of a free
+ * neighbour's class before touching it. A free block's size never
+ * changes without fine_boundary, so reading it to find the class to
+ * lock is safe; whether it's still free is checked again under that
+ * lock. Locks are always taken boundary first, then at most one class
+ * at a time, or all classes in ascending order by fine_lock_all, which
+ * covers extending the heap, realloc, the flags path and heap checks.
+ * Other policies all assume a single thread in the heap, so mm_init
+ * only turns fine locks on when none of them is.
+ */
+static bool fine_locks = false;        //Requested through mm_set_fine_locks
+static bool fine_active = false;       //Per-class locks guard this heap
+static bool fine_ready = false;        //Locks initialized
+static pthread_mutex_t fine_boundary;  //Guards block boundaries
+static pthread_mutex_t fine_class[seg_size]; //Guard each free list
+
+/*
+ * Persistent heap. The heap starts with a header recording where its
+ * free lists start and where it ends, so that a later process mapping
+ * the same memory, through memlib's file heap, can take it over with
+ * mm_reopen in time independent of the heap size. mm_checkpoint fills
+ * in the header, writes the heap back to its file and then marks the
+ * header clean; the first malloc, free or realloc after that marks it
+ * dirty again before touching anything. A process that dies in between
+ * leaves a dirty header, and mm_reopen refuses the heap rather than
+ * trust free lists that may be half updated. The marks order writes in
+ * memory, which is what a crashed process leaves behind; they don't
+ * order writes to disk against a crash of the system. Policies that
+ * keep heap state outside the heap can't be reopened, so mm_init only
+ * makes the heap persistent when none of them is on.
+ */
+static const word_t persist_magic = 0x6d6d686561703031; //"mmheap01"
+static const word_t persist_clean = 0x636c65616e;       //"clean"
+static const word_t persist_dirty = 0x6469727479;       //"dirty"
+
+typedef struct {
+    word_t magic;                  //persist_magic
+    word_t state;                  //persist_clean or persist_dirty
+    word_t checksum;               //Of the fields below, when clean
+    word_t base;                   //Address the heap was laid out at
+    word_t heap_size;              //Bytes up to the break
+    block_t *heap_end;             //Epilogue header
+    word_t compact;                //Heap had switched to compact mode
+    block_t *roots[seg_size];      //Free-list heads
+} persist_header_t;
+
+static bool persistent = false;        //Requested through mm_set_persistent
+static bool persist_active = false;    //This heap has a header
+static persist_header_t *persist_header = NULL;
+
+/*
+ * Entry points hold heap_mutex while a worker runs or slabs are on,
+ * since either lets more than one thread into the heap
+ */
+static pthread_mutex_t heap_mutex;     //Recursive, initialized once
+static bool heap_mutex_ready = false;
+
 /* Function prototypes for internal helper routines */
 static block_t *extend_heap(size_t size);
 static void place(block_t *block, size_t asize);
 static block_t *find_fit(size_t asize);
+static block_t *list_fit(block_t **lists, size_t asize);
 static block_t *coalesce(block_t *block);
 
 static size_t max(size_t x, size_t y);
@@ -176,6 +526,120 @@ static void deletion(block_t * block);
 //Used to find whether or not the previous block has been allocated
 static bool get_previous_allocation(block_t *block);
 
+//3. Side-table metadata mode
+static block_t *side_block(int index, size_t slot);
+static void side_insertion(block_t *block, size_t size);
+static void side_deletion(block_t *block, size_t size);
+static void side_spill(void);
+static block_t *side_find_fit(size_t asize);
+static side_kernel_t side_pick_kernel(void);
+static bool side_map(void);
+static size_t side_best_scalar(const uint32_t *sizes, size_t n, uint32_t need);
+
+//4. Exact-size cache
+static exact_slot_t *exact_slot(size_t size, bool create);
+static void exact_remove(exact_slot_t *slot);
+static block_t *exact_pop(size_t asize);
+static bool exact_push(block_t *block);
+static void exact_flush(void);
+//Used by free and the cache flush to return a block to the heap
+static void release(block_t *block);
+
+//5. Cache coloring
+static block_t *color_run(block_t *block, size_t asize);
+
+//6. Lifetime prediction and the nursery
+//Used to find the segregated lists a free block belongs on
+static block_t **free_lists(block_t *block);
+static void life_track(block_t *block, size_t asize);
+static void life_observe(block_t *block);
+static bool life_is_short(size_t asize);
+static block_t *nursery_fit(size_t asize);
+static bool nursery_create(size_t nsize);
+static void nursery_retire(void);
+static bool nursery_empty(void);
+
+//7. Allocation hints
+static bool get_zeroed(block_t *block);
+static void mark_zeroed(block_t *block);
+//Used by coloring and aligned placement to skip the start of a free block
+static block_t *split_front(block_t *block, size_t pad);
+static block_t *zero_fit(size_t asize);
+static block_t *best_fit(size_t asize);
+static size_t align_pad(uintptr_t payload, size_t align);
+static block_t *aligned_pick(block_t *block, block_t *candidate,
+                             size_t asize, size_t align);
+static block_t *aligned_fit(size_t asize, size_t align);
+static bool grow_in_place(block_t *block, size_t asize);
+static void shrink_in_place(block_t *block, size_t asize);
+
+//8. Soft heap limit
+static void enter_compact(void);
+static block_t *grow_heap(size_t asize);
+static size_t tail_free(void);
+static bool heap_at_top(void);
+static void trim_heap(block_t *block);
+
+//9. Page purging
+static word_t *free_stamp(block_t *block);
+static bool get_purged(block_t *block);
+static size_t purge_pages(block_t *block, char **lo);
+static void purge_block(block_t *block);
+static void purge_pass(void);
+
+//10. Background maintenance
+static void *allocate(size_t size);
+static void *allocate_flags(size_t size, int flags);
+static void deallocate(void *bp);
+static void *reallocate(void *ptr, size_t size);
+static bool check_heap(int line);
+static void heap_mutex_init(void);
+static bool heap_lock(void);
+static void heap_unlock(bool locked);
+static size_t maint_drain(size_t limit);
+static void *maint_main(void *arg);
+static void maint_start(void);
+static void maint_halt(void);
+
+//11. Lock-free slabs
+static int slab_class(size_t size);
+static bool slab_object(void *bp);
+static block_t *slab_pop(int index);
+static void slab_push(int index, block_t *first, block_t *last);
+static word_t slab_page(block_t *block);
+static block_t *slab_carve(int index, slab_owner_t *owner, block_t **last);
+static bool slab_refill(int index);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+static void *slab_realloc(void *ptr, size_t size);
+
+//12. Owned slab heaps
+static void owner_key_init(void);
+static void owner_exit(void *owner);
+static slab_owner_t *owner_get(void);
+static void owner_drain(slab_owner_t *owner);
+static void *owner_alloc(slab_owner_t *owner, int index);
+static void owner_free(slab_owner_t *owner, block_t *block);
+
+//13. Fine-grained locks
+static void fine_init(void);
+static void fine_lock_all(void);
+static void fine_unlock_all(void);
+static block_t *fine_fit(size_t asize);
+static block_t *fine_grow(size_t asize);
+static void fine_set_prev(block_t *block, bool alloc);
+static block_t *fine_claim(block_t *block);
+static void fine_coalesce(block_t *block);
+static void fine_place(block_t *block, size_t asize);
+static void *fine_malloc(size_t size);
+static void fine_free(void *bp);
+
+//14. Persistent heap
+static size_t persist_header_size(void);
+static word_t persist_checksum(persist_header_t *header);
+static void persist_touch(void);
+static void reset_heap_state(void);
+
 //Defining Function that provides information 
 //on which size class a block belongs in
 //for a segregated free list. Doing this with 
@@ -241,25 +705,34 @@ static void insertion(block_t *block, size_t size) {
     if (block == NULL) {
         return;
     }
+    //Remember when a block big enough to purge was freed
+    if (purging && size >= purge_min_size) {
+        *free_stamp(block) = purge_clock;
+    }
+    block_t **lists = free_lists(block);
+    if (side_active && lists == segregrated_list) {
+        side_insertion(block, size);
+        return;
+    }
     //Case 1: if the block being inserted is not the first block, 
     //we need to create a temp. block to store information and
     //interchange the position while preserving information.
     // We also need to update the previous and next pointers
-    if (segregrated_list[sizeIndex(size)] != NULL) {
-        block_t *placeholder = segregrated_list[sizeIndex(size)];
+    if (lists[sizeIndex(size)] != NULL) {
+        block_t *placeholder = lists[sizeIndex(size)];
         NBLOCK = placeholder;
         placeholder->block_payload.block_ties.previous = block;
         PBLOCK = NULL;
-        segregrated_list[sizeIndex(size)] = block;
+        lists[sizeIndex(size)] = block;
         return;
     }
     //Case 2: If the block being inserted is the first block, 
     //just set the first block of the seg. list to that block, and
     //set the next and previous pointers
-    if (segregrated_list[sizeIndex(size)] == NULL) {
-        segregrated_list[sizeIndex(size)] = block;
-	    segregrated_list[sizeIndex(size)]->block_payload.block_ties.previous = NULL;
-	    segregrated_list[sizeIndex(size)]->block_payload.block_ties.next = NULL;
+    if (lists[sizeIndex(size)] == NULL) {
+        lists[sizeIndex(size)] = block;
+	    lists[sizeIndex(size)]->block_payload.block_ties.previous = NULL;
+	    lists[sizeIndex(size)]->block_payload.block_ties.next = NULL;
         return;
     }
 }
@@ -274,10 +747,15 @@ static void deletion(block_t *block) {
     block_t *block_previous = PBLOCK;
     size_t size = get_size(block);
     dbg_printf("\nDeleting Block--> Size:%li | Pointer:%p",size,block);
+    block_t **lists = free_lists(block);
+    if (side_active && lists == segregrated_list) {
+        side_deletion(block, size);
+        return;
+    }
     
     //Case 1: If it is the only block in the list, just set front to NULL
     if (block_next == NULL && block_previous == NULL) {
-        segregrated_list[sizeIndex(size)] = NULL;
+        lists[sizeIndex(size)] = NULL;
         return;
     }
     // Case 2: If there is a previous block, 
@@ -286,61 +764,2143 @@ static void deletion(block_t *block) {
         block_previous->block_payload.block_ties.next = NULL;
         return;
     }
-    //Case 3: If there is a next block, 
-    //set the next block's previous pointer to null and set the pointer
-    //of the respective seg. list equal to the next block
-    if (block_next != NULL && block_previous == NULL) {
-        block_next->block_payload.block_ties.previous = NULL;
-        segregrated_list[sizeIndex(size)] = block_next;
-        return;
+    //Case 3: If there is a next block, 
+    //set the next block's previous pointer to null and set the pointer
+    //of the respective seg. list equal to the next block
+    if (block_next != NULL && block_previous == NULL) {
+        block_next->block_payload.block_ties.previous = NULL;
+        lists[sizeIndex(size)] = block_next;
+        return;
+    }
+    //Case 4: If both the next and previous pointers exist, 
+    //then we need to remove the block between them.
+    if (block_next != NULL && block_previous != NULL) {
+        block_previous->block_payload.block_ties.next = block_next;
+        block_next->block_payload.block_ties.previous = block_previous;
+        return;
+    }
+}
+
+/*
+ * side_block returns the free block recorded in the given slot
+ * of a size class in the side table.
+ */
+static block_t *side_block(int index, size_t slot) {
+    return (block_t *)((char *)heap_start
+                       + ((size_t)side_offsets[index][slot] << 4));
+}
+
+/*
+ * side_insertion appends a (size, offset) record for a free block to
+ * the side table of its size class, remembering the slot in the block
+ * so deletion is O(1). Blocks that cannot be recorded spill the table.
+ */
+static void side_insertion(block_t *block, size_t size) {
+    int index = sizeIndex(size);
+    size_t slot = side_count[index];
+    size_t offset = ((char *)block - (char *)heap_start) >> 4;
+
+    if (slot == side_capacity || (size >> 4) > side_limit
+            || offset > side_limit) {
+        side_spill();
+        insertion(block, size);
+        return;
+    }
+    side_sizes[index][slot] = (uint32_t)(size >> 4);
+    side_offsets[index][slot] = (uint32_t)offset;
+    block->block_payload.side_index = slot;
+    side_count[index] = slot + 1;
+}
+
+/*
+ * side_deletion removes a block's record by moving the last record
+ * of the class into its slot, and updating that block's slot number.
+ */
+static void side_deletion(block_t *block, size_t size) {
+    int index = sizeIndex(size);
+    size_t slot = block->block_payload.side_index;
+    size_t last = --side_count[index];
+
+    dbg_assert(side_block(index, slot) == block);
+    if (slot != last) {
+        side_sizes[index][slot] = side_sizes[index][last];
+        side_offsets[index][slot] = side_offsets[index][last];
+        side_block(index, slot)->block_payload.side_index = slot;
+    }
+}
+
+/*
+ * side_spill turns side-table mode off for the rest of this heap,
+ * moving every recorded block onto the segregated lists.
+ */
+static void side_spill(void) {
+    int i;
+    size_t slot;
+    dbg_printf("\nSPILLING SIDE TABLE");
+    side_active = false;
+    for (i = 0; i < seg_size; i++) {
+        for (slot = 0; slot < side_count[i]; slot++) {
+            insertion(side_block(i, slot), (size_t)side_sizes[i][slot] << 4);
+        }
+        side_count[i] = 0;
+    }
+}
+
+/*
+ * side_find_fit is find_fit for side-table mode. Starting with the
+ * most recently freed records, it hands windows of side_window records
+ * to the compare kernel and returns the best fit of the first window
+ * holding any fit at all.
+ */
+static block_t *side_find_fit(size_t asize) {
+    uint32_t need = (uint32_t)(asize >> 4);
+    int index;
+    size_t end, start, slot;
+
+    if ((asize >> 4) > side_limit) {
+        return NULL;
+    }
+    for (index = sizeIndex(asize); index != seg_size; index++) {
+        for (end = side_count[index]; end > 0; end = start) {
+            start = (end > side_window) ? end - side_window : 0;
+            slot = side_best(side_sizes[index] + start, end - start, need);
+            if (slot < end - start) {
+                return side_block(index, start + slot);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Compare kernels: each returns the index of the smallest of the n sizes
+ * that is at least need, picking the lowest index on ties, or n when no
+ * size fits. Sizes are below INT32_MAX, so signed compares are safe.
+ */
+static size_t side_best_scalar(const uint32_t *sizes, size_t n, uint32_t need) {
+    size_t i;
+    size_t best = n;
+    uint32_t best_size = INT32_MAX;
+    for (i = 0; i < n; i++) {
+        if (sizes[i] >= need && sizes[i] < best_size) {
+            best_size = sizes[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * side_reduce finishes a vector search: it picks the best of the
+ * per-lane winners, then scans the tail the vectors did not cover.
+ */
+static size_t side_reduce(const uint32_t *sizes, size_t n, uint32_t need,
+                          const int32_t *lane_size, const int32_t *lane_index,
+                          int lanes, size_t done) {
+    int lane;
+    size_t best = n;
+    uint32_t best_size = INT32_MAX;
+    size_t tail;
+    for (lane = 0; lane < lanes; lane++) {
+        if (lane_index[lane] < 0) {
+            continue;
+        }
+        if ((uint32_t)lane_size[lane] < best_size
+                || ((uint32_t)lane_size[lane] == best_size
+                    && (size_t)lane_index[lane] < best)) {
+            best_size = lane_size[lane];
+            best = lane_index[lane];
+        }
+    }
+    tail = done + side_best_scalar(sizes + done, n - done, need);
+    if (tail < n && sizes[tail] < best_size) {
+        best = tail;
+    }
+    return best;
+}
+
+static size_t side_best_sse2(const uint32_t *sizes, size_t n, uint32_t need) {
+    __m128i vneed = _mm_set1_epi32((int32_t)need - 1);
+    __m128i vbest = _mm_set1_epi32(INT32_MAX);
+    __m128i vbest_index = _mm_set1_epi32(-1);
+    __m128i vindex = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i vstep = _mm_set1_epi32(4);
+    int32_t lane_size[4], lane_index[4];
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i vsize = _mm_loadu_si128((const __m128i *)(sizes + i));
+        __m128i better = _mm_and_si128(_mm_cmpgt_epi32(vsize, vneed),
+                                       _mm_cmplt_epi32(vsize, vbest));
+        vbest = _mm_or_si128(_mm_and_si128(better, vsize),
+                             _mm_andnot_si128(better, vbest));
+        vbest_index = _mm_or_si128(_mm_and_si128(better, vindex),
+                                   _mm_andnot_si128(better, vbest_index));
+        vindex = _mm_add_epi32(vindex, vstep);
+    }
+    _mm_storeu_si128((__m128i *)lane_size, vbest);
+    _mm_storeu_si128((__m128i *)lane_index, vbest_index);
+    return side_reduce(sizes, n, need, lane_size, lane_index, 4, i);
+}
+
+__attribute__((target("avx2")))
+static size_t side_best_avx2(const uint32_t *sizes, size_t n, uint32_t need) {
+    __m256i vneed = _mm256_set1_epi32((int32_t)need - 1);
+    __m256i vbest = _mm256_set1_epi32(INT32_MAX);
+    __m256i vbest_index = _mm256_set1_epi32(-1);
+    __m256i vindex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vstep = _mm256_set1_epi32(8);
+    int32_t lane_size[8], lane_index[8];
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i vsize = _mm256_loadu_si256((const __m256i *)(sizes + i));
+        __m256i better = _mm256_and_si256(_mm256_cmpgt_epi32(vsize, vneed),
+                                          _mm256_cmpgt_epi32(vbest, vsize));
+        vbest = _mm256_blendv_epi8(vbest, vsize, better);
+        vbest_index = _mm256_blendv_epi8(vbest_index, vindex, better);
+        vindex = _mm256_add_epi32(vindex, vstep);
+    }
+    _mm256_storeu_si256((__m256i *)lane_size, vbest);
+    _mm256_storeu_si256((__m256i *)lane_index, vbest_index);
+    return side_reduce(sizes, n, need, lane_size, lane_index, 8, i);
+}
+#endif
+
+/*
+ * side_pick_kernel chooses the widest compare kernel the CPU supports
+ */
+static side_kernel_t side_pick_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return side_best_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return side_best_sse2;
+    }
+#endif
+    return side_best_scalar;
+}
+
+/*
+ * side_map maps the record arrays the first time a heap uses them,
+ * returning false if there's no memory for them
+ */
+static bool side_map(void) {
+    size_t bytes = (size_t)seg_size * side_capacity * sizeof(uint32_t);
+    uint32_t *area;
+
+    if (side_sizes != NULL) {
+        return true;
+    }
+    area = mmap(NULL, 2 * bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        return false;
+    }
+    side_sizes = (uint32_t (*)[side_capacity])area;
+    side_offsets = (uint32_t (*)[side_capacity])((char *)area + bytes);
+    return true;
+}
+
+/*
+ * mm_set_side_table selects side-table metadata for the free blocks
+ * of the next heap set up by mm_init.
+ */
+void mm_set_side_table(bool enable) {
+    side_table = enable;
+}
+
+/*
+ * exact_slot finds the table slot for a block size, probing at most
+ * exact_probe slots. With create set, an unused slot is claimed for it.
+ */
+static exact_slot_t *exact_slot(size_t size, bool create) {
+    size_t i;
+    size_t hash = size >> 4;
+    for (i = 0; i < exact_probe; i++) {
+        exact_slot_t *slot = &exact_table[(hash + i) & (exact_slots - 1)];
+        if (slot->size == size) {
+            return slot;
+        }
+        if (slot->size == 0) {
+            if (!create) {
+                return NULL;
+            }
+            slot->size = size;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * exact_remove frees a slot whose stack is empty, shifting back each
+ * slot after it that probed past it, so no lookup meets a hole early
+ */
+static void exact_remove(exact_slot_t *slot) {
+    size_t i = (size_t)(slot - exact_table);
+    size_t j, home;
+    size_t mask = exact_slots - 1;
+
+    for (j = (i + 1) & mask; j != i && exact_table[j].size != 0;
+            j = (j + 1) & mask) {
+        home = (exact_table[j].size >> 4) & mask;
+        //Move the slot at j to the hole at i, if i lies from home to j
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            exact_table[i] = exact_table[j];
+            i = j;
+        }
+    }
+    exact_table[i].size = 0;
+    exact_table[i].top = NULL;
+    exact_table[i].count = 0;
+}
+
+/*
+ * exact_pop returns a cached block of exactly asize bytes, or NULL.
+ * Every exact_window lookups it checks the hit rate, and turns the
+ * cache off if too few lookups were hits.
+ */
+static block_t *exact_pop(size_t asize) {
+    exact_slot_t *slot = exact_slot(asize, false);
+    block_t *block = NULL;
+
+    exact_lookups++;
+    if (slot != NULL && slot->top != NULL) {
+        block = slot->top;
+        slot->top = block->block_payload.block_ties.next;
+        //Give the slot up once its last block is taken, so sizes
+        //the program stops using don't fill the table
+        if (--slot->count == 0) {
+            exact_remove(slot);
+        }
+        exact_hits++;
+        exact_window_hits++;
+    }
+    if (++exact_window_lookups == exact_window) {
+        if (exact_window_hits < exact_min_hits) {
+            dbg_printf("\nEXACT CACHE OFF: %zu hits", exact_window_hits);
+            exact_flush();
+            exact_active = false;
+        }
+        exact_window_lookups = 0;
+        exact_window_hits = 0;
+    }
+    return block;
+}
+
+/*
+ * exact_push caches a block that is being freed, leaving it marked
+ * allocated. Returns false if the block's size can't be cached.
+ */
+static bool exact_push(block_t *block) {
+    size_t size = get_size(block);
+    exact_slot_t *slot;
+
+    if (size > exact_max_size) {
+        return false;
+    }
+    slot = exact_slot(size, true);
+    if (slot == NULL || slot->count == exact_depth) {
+        return false;
+    }
+    //The next malloc of this size may not have asked for slack
+    block->header &= ~grow_mask;
+    block->block_payload.block_ties.next = slot->top;
+    slot->top = block;
+    slot->count++;
+    return true;
+}
+
+/*
+ * exact_flush frees every cached block back into the heap
+ */
+static void exact_flush(void) {
+    int i;
+    for (i = 0; i < exact_slots; i++) {
+        exact_slot_t *slot = &exact_table[i];
+        while (slot->top != NULL) {
+            block_t *block = slot->top;
+            slot->top = block->block_payload.block_ties.next;
+            release(block);
+        }
+        slot->size = 0;
+        slot->count = 0;
+    }
+}
+
+/*
+ * mm_set_exact_cache selects the exact-size cache for the next heap
+ */
+void mm_set_exact_cache(bool enable) {
+    exact_cache = enable;
+}
+
+/*
+ * mm_exact_cache_stats reports the lookups and hits of the exact-size
+ * cache since mm_init. Returns whether the cache is still enabled.
+ */
+bool mm_exact_cache_stats(size_t *lookups, size_t *hits) {
+    *lookups = exact_lookups;
+    *hits = exact_hits;
+    return exact_active;
+}
+
+/*
+ * color_run takes a free block just obtained from extend_heap for a run
+ * of asize blocks, and splits off a leading free block so that the run
+ * starts at the next color of asize's size class. Returns the free block
+ * the run should be placed in.
+ */
+static block_t *color_run(block_t *block, size_t asize) {
+    int index = sizeIndex(asize);
+    size_t pad = (color_next[index]++ % color_count) * color_line;
+
+    if (pad == 0 || get_size(block) < pad + asize) {
+        return block;
+    }
+    dbg_printf("\nCOLORING run of %zx at +%zu", asize, pad);
+    return split_front(block, pad);
+}
+
+/*
+ * mm_set_coloring selects cache coloring of small-block runs
+ */
+void mm_set_coloring(bool enable) {
+    coloring = enable;
+}
+
+/*
+ * free_lists returns the nursery lists for blocks inside the nursery,
+ * and the main segregated lists for every other block
+ */
+static block_t **free_lists(block_t *block) {
+    if ((char *)block >= nursery_lo && (char *)block < nursery_hi) {
+        return nursery_list;
+    }
+    return segregrated_list;
+}
+
+/*
+ * life_track advances the clock for a malloc call, and starts timing
+ * one in life_sample_rate of the blocks handed out
+ */
+static void life_track(block_t *block, size_t asize) {
+    life_sample_t *sample;
+    size_t size = get_size(block);
+
+    life_allocs++;
+    if (free_lists(block) == nursery_list) {
+        nursery_allocs++;
+        nursery_live += size;
+    }
+    if (life_clock++ % life_sample_rate != 0) {
+        return;
+    }
+    sample = &life_table[((uintptr_t)block >> 4) & (life_table_size - 1)];
+    if (sample->block == NULL) {
+        sample->block = block;
+        sample->born = life_clock;
+        sample->index = sizeIndex(asize);
+    }
+}
+
+/*
+ * life_observe advances the clock for a free call, and folds the
+ * lifetime of a sampled block into the average of its size class
+ */
+static void life_observe(block_t *block) {
+    life_sample_t *sample;
+    size_t size = get_size(block);
+    size_t age;
+    int index;
+
+    //realloc can resize a block in place, so the count only estimates
+    if (free_lists(block) == nursery_list) {
+        nursery_live -= (nursery_live > size) ? size : nursery_live;
+    }
+    life_clock++;
+    sample = &life_table[((uintptr_t)block >> 4) & (life_table_size - 1)];
+    if (sample->block != block) {
+        return;
+    }
+    age = life_clock - sample->born;
+    index = sample->index;
+    if (life_samples[index]++ == 0) {
+        life_avg[index] = age << 3;
+    } else {
+        life_avg[index] += age - (life_avg[index] >> 3);
+    }
+    life_avg_all += age - (life_avg_all >> 6);
+    sample->block = NULL;
+}
+
+/*
+ * life_is_short predicts whether a block of asize bytes will die young
+ */
+static bool life_is_short(size_t asize) {
+    int index = sizeIndex(asize);
+    return life_samples[index] >= life_min_samples
+        && life_short_ratio * (life_avg[index] << 3) < life_avg_all;
+}
+
+/*
+ * nursery_fit finds a free block for asize in the nursery, setting
+ * the nursery up the first time, and moving it to a bigger one if
+ * it is full of live blocks. Returns NULL if nothing fits.
+ */
+static block_t *nursery_fit(size_t asize) {
+    block_t *block;
+
+    if (nursery_lo == NULL) {
+        return nursery_create(max(nursery_next, 2 * asize))
+            ? list_fit(nursery_list, asize) : NULL;
+    }
+    block = list_fit(nursery_list, asize);
+    //A nursery that is mostly holes only needs its blocks to die
+    if (block == NULL && 2 * nursery_live > (size_t)(nursery_hi - nursery_lo)) {
+        nursery_next = 2 * (size_t)(nursery_hi - nursery_lo);
+        nursery_retire();
+        if (nursery_create(max(nursery_next, 2 * asize))) {
+            block = list_fit(nursery_list, asize);
+        }
+    }
+    return block;
+}
+
+/*
+ * nursery_empty returns whether the nursery is one free block
+ */
+static bool nursery_empty(void) {
+    block_t *block = (block_t *)nursery_lo;
+    return !get_alloc(block)
+        && (char *)block + get_size(block) == nursery_hi;
+}
+
+/*
+ * nursery_retire hands the nursery back to the heap: its free blocks
+ * move to the main lists, and its fences are freed to coalesce with
+ * them. The blocks still live in it are freed as usual later.
+ */
+static void nursery_retire(void) {
+    block_t *lo_fence = (block_t *)(nursery_lo - min_block_size);
+    block_t *hi_fence = (block_t *)nursery_hi;
+    block_t *moved = NULL;
+    block_t *block;
+
+    dbg_printf("\nRETIRING NURSERY %p", nursery_lo);
+    for (block = (block_t *)nursery_lo; block != hi_fence;
+            block = find_next(block)) {
+        if (!get_alloc(block)) {
+            deletion(block);
+            block->block_payload.block_ties.next = moved;
+            moved = block;
+        }
+    }
+    nursery_lo = NULL;
+    nursery_hi = NULL;
+    nursery_live = 0;
+    while (moved != NULL) {
+        block = moved;
+        moved = block->block_payload.block_ties.next;
+        insertion(block, get_size(block));
+    }
+    release(hi_fence);
+    release(lo_fence);
+}
+
+/*
+ * nursery_create carves a nursery of nsize bytes out of a free block,
+ * extending the heap if none is big enough, between two allocated fences:
+ *   [fence][nursery free block][fence][rest of the free block]
+ */
+static bool nursery_create(size_t nsize) {
+    size_t fence = min_block_size;
+    size_t csize, rest;
+    word_t extract;
+    block_t *block, *nursery, *hi_fence;
+
+    nsize = round_up(nsize, dsize);
+    //Prefer free space the heap already has to growing it
+    if ((block = find_fit(nsize + 2 * fence)) == NULL
+            && (block = extend_heap(nsize + 2 * fence)) == NULL) {
+        return false;
+    }
+    dbg_printf("\nCREATING NURSERY");
+    csize = get_size(block);
+    rest = csize - nsize - 2 * fence;
+    if (rest < min_block_size) {
+        nsize += rest;
+        rest = 0;
+    }
+    extract = (block->header) & alloc_bit;
+    deletion(block);
+
+    write_header(block, fence|extract, true);
+    nursery = find_next(block);
+    write_header(nursery, nsize|alloc_bit, false);
+    write_footer(nursery, nsize|alloc_bit, false);
+    hi_fence = find_next(nursery);
+    write_header(hi_fence, fence, true);
+    nursery_lo = (char *)nursery;
+    nursery_hi = (char *)hi_fence;
+    insertion(nursery, nsize);
+
+    if (rest > 0) {
+        block_t *tail = find_next(hi_fence);
+        write_header(tail, rest|alloc_bit, false);
+        write_footer(tail, rest|alloc_bit, false);
+        insertion(tail, rest);
+    }
+    return true;
+}
+
+/*
+ * mm_set_lifetime selects lifetime prediction and nursery placement
+ */
+void mm_set_lifetime(bool enable) {
+    lifetime = enable;
+}
+
+/*
+ * mm_lifetime_stats reports how many of the blocks allocated since
+ * mm_init were placed in the nursery
+ */
+void mm_lifetime_stats(size_t *allocs, size_t *nursery) {
+    *allocs = life_allocs;
+    *nursery = nursery_allocs;
+}
+
+/*
+ * get_zeroed returns whether a free block is known to be zero
+ */
+static bool get_zeroed(block_t *block) {
+    return (block->header & zero_mask) != 0;
+}
+
+/*
+ * mark_zeroed records that a free block is zero, apart from
+ * its link words and footer
+ */
+static void mark_zeroed(block_t *block) {
+    block->header = block->header | zero_mask;
+}
+
+/*
+ * split_front splits the first pad bytes off a free block as a free
+ * block of their own, and returns the free block that follows them.
+ * pad must be at least min_block_size and leave a minimum block behind.
+ */
+static block_t *split_front(block_t *block, size_t pad) {
+    size_t csize = get_size(block);
+    word_t extract = (block->header) & alloc_bit;
+    bool zeroed = get_zeroed(block);
+    block_t *rest;
+
+    deletion(block);
+    write_header(block, pad|extract, false);
+    write_footer(block, pad|extract, false);
+    rest = find_next(block);
+    write_header(rest, csize - pad, false);
+    write_footer(rest, csize - pad, false);
+    //Only the old footer and the new boundary words were written
+    if (zeroed) {
+        mark_zeroed(block);
+        mark_zeroed(rest);
+    }
+    insertion(block, pad);
+    insertion(rest, csize - pad);
+    return rest;
+}
+
+/*
+ * zero_fit looks at the first zero_scan blocks of each size class
+ * for a known-zero block of at least asize bytes. Returns NULL if none.
+ */
+static block_t *zero_fit(size_t asize) {
+    block_t *block;
+    size_t seen, slot;
+    int index;
+
+    for (index = sizeIndex(asize); index != seg_size; index++) {
+        seen = 0;
+        if (side_active) {
+            for (slot = side_count[index]; slot > 0 && seen++ < zero_scan;
+                    slot--) {
+                block = side_block(index, slot - 1);
+                if (get_zeroed(block) && asize <= get_size(block)) {
+                    return block;
+                }
+            }
+            continue;
+        }
+        for (block = segregrated_list[index]; block != NULL
+                && seen++ < zero_scan; block = NBLOCK) {
+            if (get_zeroed(block) && asize <= get_size(block)) {
+                return block;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * best_fit returns the smallest free block of at least asize bytes,
+ * searching the whole of the first size class that holds any fit.
+ * Classes don't overlap, so no later class can hold a better one.
+ */
+static block_t *best_fit(size_t asize) {
+    block_t *block;
+    block_t *bestblock;
+    size_t slot;
+    int index;
+
+    for (index = sizeIndex(asize); index != seg_size; index++) {
+        if (side_active) {
+            if ((asize >> 4) > side_limit) {
+                return NULL;
+            }
+            slot = side_best(side_sizes[index], side_count[index],
+                             (uint32_t)(asize >> 4));
+            if (slot < side_count[index]) {
+                return side_block(index, slot);
+            }
+            continue;
+        }
+        bestblock = NULL;
+        for (block = segregrated_list[index]; block != NULL; block = NBLOCK) {
+            if (asize <= get_size(block) && (bestblock == NULL
+                    || get_size(block) < get_size(bestblock))) {
+                bestblock = block;
+                if (get_size(block) == asize) {
+                    break;
+                }
+            }
+        }
+        if (bestblock != NULL) {
+            return bestblock;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * align_pad returns how many bytes to split off the front of a block
+ * whose payload is at payload so the rest starts on an align-byte boundary
+ */
+static size_t align_pad(uintptr_t payload, size_t align) {
+    size_t pad = round_up(payload, align) - payload;
+
+    //The free block in front must be big enough to stand on its own
+    if (pad != 0 && pad < min_block_size) {
+        pad += align;
+    }
+    return pad;
+}
+
+/*
+ * aligned_pick returns candidate if it can hold asize bytes at the
+ * given alignment and is smaller than block, and otherwise block
+ */
+static block_t *aligned_pick(block_t *block, block_t *candidate,
+                             size_t asize, size_t align) {
+    if (align_pad((uintptr_t)header_to_payload(candidate), align) + asize
+            > get_size(candidate)) {
+        return block;
+    }
+    if (block != NULL && get_size(block) <= get_size(candidate)) {
+        return block;
+    }
+    return candidate;
+}
+
+/*
+ * aligned_fit returns a free block of at least asize bytes whose payload
+ * starts on an align-byte boundary, splitting off the free block in front
+ * of it, and extending the heap if nothing fits. align is a power of two
+ * of at least dsize. Returns NULL if the heap can't grow.
+ */
+static block_t *aligned_fit(size_t asize, size_t align) {
+    block_t *block = NULL;
+    block_t *candidate;
+    size_t need = asize + align + min_block_size;
+    size_t slot, pad, seen;
+    int index;
+
+    //Like list_fit, take the best of the first few blocks that fit in
+    //the first class holding any, counting the front each would lose
+    for (index = sizeIndex(asize); index != seg_size && block == NULL;
+            index++) {
+        seen = 0;
+        if (side_active) {
+            for (slot = side_count[index]; slot > 0
+                    && (block == NULL || seen++ < align_scan); slot--) {
+                block = aligned_pick(block, side_block(index, slot - 1),
+                                     asize, align);
+            }
+            continue;
+        }
+        for (candidate = segregrated_list[index]; candidate != NULL
+                && (block == NULL || seen++ < align_scan);
+                candidate = candidate->block_payload.block_ties.next) {
+            block = aligned_pick(block, candidate, asize, align);
+        }
+    }
+    if (block == NULL) {
+        //At the top, grow by the block and the front it needs, not by
+        //a whole alignment more. Like grow_heap, leave the free tail it
+        //merges with as room for the small blocks that follow.
+        if (heap_at_top()) {
+            pad = align_pad((uintptr_t)heap_end - tail_free() + wsize, align);
+            need = pad + asize;
+        }
+        if ((block = extend_heap(max(need, chunksize))) == NULL) {
+            return NULL;
+        }
+    }
+    pad = align_pad((uintptr_t)header_to_payload(block), align);
+    if (pad == 0) {
+        return block;
+    }
+    return split_front(block, pad);
+}
+
+/*
+ * mm_set_huge_align selects huge-page alignment of large blocks
+ */
+void mm_set_huge_align(bool enable) {
+    huge_align = enable;
+}
+
+/*
+ * mm_set_remap selects moving large blocks by page remapping on realloc
+ */
+void mm_set_remap(bool enable) {
+    remapping = enable;
+}
+
+/*
+ * mm_remap_stats returns the bytes realloc remapped since mm_init
+ */
+size_t mm_remap_stats(void) {
+    return remapped_bytes;
+}
+
+/*
+ * grow_in_place grows an allocated block to asize bytes by taking
+ * over the free block after it, returning false if that isn't enough
+ */
+static bool grow_in_place(block_t *block, size_t asize) {
+    block_t *next = find_next(block);
+    size_t csize = get_size(block);
+    word_t extract = (block->header) & (alloc_bit | grow_mask);
+
+    if (get_alloc(next) || csize + get_size(next) < asize) {
+        return false;
+    }
+    dbg_printf("\nGROWING %p in place to %zx", block, asize);
+    csize += get_size(next);
+    deletion(next);
+    if ((csize - asize) >= min_block_size) {
+        write_header(block, asize|extract, true);
+        write_footer(block, asize|extract, true);
+        next = find_next(block);
+        write_header(next, (csize - asize)|alloc_bit, false);
+        write_footer(next, (csize - asize)|alloc_bit, false);
+        insertion(next, csize - asize);
+    } else {
+        write_header(block, csize|extract, true);
+        write_footer(block, csize|extract, true);
+    }
+    return true;
+}
+
+/*
+ * shrink_in_place shrinks an allocated block to asize bytes, splitting
+ * the rest off as a free block if it is big enough to be one
+ */
+static void shrink_in_place(block_t *block, size_t asize) {
+    size_t csize = get_size(block);
+    word_t extract = (block->header) & (alloc_bit | grow_mask);
+    block_t *rest;
+
+    if ((csize - asize) < min_block_size) {
+        return;
+    }
+    dbg_printf("\nSHRINKING %p in place to %zx", block, asize);
+    //No footer: an allocated block's last word is still payload
+    write_header(block, asize|extract, true);
+    rest = find_next(block);
+    write_header(rest, (csize - asize)|alloc_bit, false);
+    write_footer(rest, (csize - asize)|alloc_bit, false);
+    //The block after the rest now follows a free block
+    find_next(rest)->header &= ~alloc_bit;
+    rest = coalesce(rest);
+    if (compact) {
+        trim_heap(rest);
+    }
+}
+
+/*
+ * enter_compact switches the heap to compact mode for the rest of the run,
+ * giving every block in the exact-size cache back to the heap
+ */
+static void enter_compact(void) {
+    dbg_printf("\nCOMPACT MODE at %zu bytes", mem_heapsize());
+    compact = true;
+    maint_drain(maint_pending_count);
+    if (exact_active) {
+        exact_flush();
+        exact_active = false;
+    }
+}
+
+/*
+ * grow_heap extends the heap for a block of asize bytes that no free
+ * block fits, switching to compact mode before passing the soft limit
+ * or failing. Returns the free block to place in, or NULL.
+ */
+static block_t *grow_heap(size_t asize) {
+    block_t *block;
+
+    //Blocks waiting for the worker may coalesce into a fit
+    if (maint_pending != NULL)
+    {
+        maint_drain(maint_pending_count);
+        if ((block = find_fit(asize)) != NULL)
+        {
+            return block;
+        }
+    }
+    //So may the space of an empty nursery
+    if (nursery_lo != NULL && nursery_empty())
+    {
+        nursery_retire();
+        if ((block = find_fit(asize)) != NULL)
+        {
+            return block;
+        }
+    }
+    if (!compact)
+    {
+        if (heap_limit == 0
+                || mem_heapsize() + max(asize, chunksize) <= heap_limit)
+        {
+            if ((block = extend_heap(max(asize, chunksize))) != NULL)
+            {
+                return block;
+            }
+        }
+        //Flushing the cache may free up a fit
+        enter_compact();
+        if ((block = find_fit(asize)) != NULL)
+        {
+            return block;
+        }
+    }
+    //The tail only grows in place if nothing was reserved above it
+    return extend_heap(heap_at_top() ? asize - tail_free() : asize);
+}
+
+/*
+ * tail_free returns the size of the free block at the end of the heap,
+ * or 0 if the last block is allocated
+ */
+static size_t tail_free(void) {
+    if (get_previous_allocation(heap_end)) {
+        return 0;
+    }
+    return get_size(find_prev(heap_end));
+}
+
+/*
+ * heap_at_top returns whether the heap ends at memlib's break, with no
+ * memory other threads reserved above it
+ */
+static bool heap_at_top(void) {
+    return (char *)heap_end + wsize == (char *)mem_heap_hi() + 1;
+}
+
+/*
+ * trim_heap gives all but chunksize bytes of a free block at the
+ * end of the heap back to memlib. Memory some thread reserved above
+ * the heap, or may be reserving now, stays put.
+ */
+static void trim_heap(block_t *block) {
+    size_t size = get_size(block);
+    word_t extract = (block->header) & alloc_bit;
+
+    if (size < 2 * chunksize || get_size(find_next(block)) != 0
+            || owned_active || !heap_at_top()) {
+        return;
+    }
+    if (mem_sbrk(-(intptr_t)(size - chunksize)) == (void *)-1) {
+        return;
+    }
+    dbg_printf("\nTRIMMING %zx bytes", size - chunksize);
+    deletion(block);
+    write_header(block, chunksize|extract, false);
+    write_footer(block, chunksize|extract, false);
+    heap_end = find_next(block);
+    write_header(heap_end, 0, true);
+    insertion(block, chunksize);
+}
+
+/*
+ * mm_set_soft_limit sets the heap size at which the next heap set up
+ * by mm_init switches to compact mode, 0 for no limit
+ */
+void mm_set_soft_limit(size_t bytes) {
+    soft_limit = bytes;
+}
+
+/*
+ * mm_compact_mode returns whether the heap has switched to compact mode
+ */
+bool mm_compact_mode(void) {
+    return compact;
+}
+
+/*
+ * free_stamp returns the payload word of a free block that holds
+ * the value of purge_clock when the block went on a free list
+ */
+static word_t *free_stamp(block_t *block) {
+    return (word_t *)header_to_payload(block) + 2;
+}
+
+/*
+ * get_purged returns whether a free block's interior pages are purged
+ */
+static bool get_purged(block_t *block) {
+    return (block->header & purged_mask) != 0;
+}
+
+/*
+ * purge_pages finds the whole pages of a free block that lie past its
+ * links and stamp and before its footer. Sets *lo to the first of them
+ * and returns their size in bytes, 0 if there are none.
+ */
+static size_t purge_pages(block_t *block, char **lo) {
+    uintptr_t start = (uintptr_t)(free_stamp(block) + 1);
+    uintptr_t end = (uintptr_t)block + get_size(block) - wsize;
+
+    start = round_up(start, page_size);
+    end -= end % page_size;
+    *lo = (char *)start;
+    return (end > start) ? end - start : 0;
+}
+
+/*
+ * purge_block purges the interior pages of a large free block
+ * if it has been free for at least purge_delay frees
+ */
+static void purge_block(block_t *block) {
+    size_t len;
+    char *lo;
+
+    if (get_size(block) < purge_min_size || get_zeroed(block)
+            || get_purged(block)
+            || purge_clock - *free_stamp(block) < purge_delay) {
+        return;
+    }
+    if ((len = purge_pages(block, &lo)) == 0) {
+        return;
+    }
+    dbg_printf("\nPURGING %zx bytes of %p", len, block);
+    mem_purge(lo, len);
+    block->header = block->header | purged_mask;
+    purged_bytes += len;
+}
+
+/*
+ * purge_pass runs purge_block over the size classes of large blocks
+ */
+static void purge_pass(void) {
+    block_t *block;
+    size_t slot;
+    int index;
+
+    for (index = sizeIndex(purge_min_size); index != seg_size; index++) {
+        if (side_active) {
+            for (slot = 0; slot < side_count[index]; slot++) {
+                purge_block(side_block(index, slot));
+            }
+            continue;
+        }
+        for (block = segregrated_list[index]; block != NULL; block = NBLOCK) {
+            purge_block(block);
+        }
+    }
+}
+
+/*
+ * mm_set_purging selects purging of idle free pages for the next heap
+ */
+void mm_set_purging(bool enable) {
+    purging = enable;
+}
+
+/*
+ * mm_purge_stats returns the number of bytes purged since mm_init
+ */
+size_t mm_purge_stats(void) {
+    return purged_bytes;
+}
+
+/*
+ * heap_mutex_init sets up the heap lock the first time it's needed
+ */
+static void heap_mutex_init(void) {
+    pthread_mutexattr_t attr;
+    if (heap_mutex_ready) {
+        return;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&heap_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    heap_mutex_ready = true;
+}
+
+/*
+ * heap_lock takes the heap lock if other threads may be in the heap,
+ * and returns whether it did
+ */
+static bool heap_lock(void) {
+    if (fine_active) {
+        fine_lock_all();
+        return true;
+    }
+    if (!maint_running && !slab_active) {
+        return false;
+    }
+    pthread_mutex_lock(&heap_mutex);
+    return true;
+}
+
+/*
+ * heap_unlock releases the lock if heap_lock took it
+ */
+static void heap_unlock(bool locked) {
+    if (locked && fine_active) {
+        fine_unlock_all();
+    } else if (locked) {
+        pthread_mutex_unlock(&heap_mutex);
+    }
+}
+
+/*
+ * maint_drain coalesces up to limit pending blocks into the heap,
+ * returning how many it did
+ */
+static size_t maint_drain(size_t limit) {
+    size_t count;
+    for (count = 0; count < limit && maint_pending != NULL; count++) {
+        block_t *block = maint_pending;
+        maint_pending = block->block_payload.block_ties.next;
+        maint_pending_count--;
+        release(block);
+    }
+    return count;
+}
+
+/*
+ * maint_main is the worker: each pass coalesces the pending blocks a
+ * batch at a time, runs a purge pass and trims a large free tail,
+ * taking the lock separately for each step
+ */
+static void *maint_main(void *arg) {
+    struct timespec period = { 0, maint_period_ns };
+    size_t drained;
+    block_t *tail;
+
+    while (!__atomic_load_n(&maint_stop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&period, NULL);
+        do {
+            pthread_mutex_lock(&heap_mutex);
+            drained = maint_drain(maint_batch);
+            pthread_mutex_unlock(&heap_mutex);
+        } while (drained == maint_batch
+                 && !__atomic_load_n(&maint_stop, __ATOMIC_ACQUIRE));
+        if (purging) {
+            pthread_mutex_lock(&heap_mutex);
+            purge_pass();
+            pthread_mutex_unlock(&heap_mutex);
+        }
+        pthread_mutex_lock(&heap_mutex);
+        if (tail_free() >= maint_trim_size) {
+            tail = find_prev(heap_end);
+            trim_heap(tail);
+        }
+        pthread_mutex_unlock(&heap_mutex);
+    }
+    return NULL;
+}
+
+/*
+ * maint_start starts a worker for the heap mm_init just set up
+ */
+static void maint_start(void) {
+    heap_mutex_init();
+    maint_stop = false;
+    if (pthread_create(&maint_thread, NULL, maint_main, NULL) == 0) {
+        maint_running = true;
+    }
+}
+
+/*
+ * maint_halt stops the worker, if one is running
+ */
+static void maint_halt(void) {
+    if (!maint_running) {
+        return;
+    }
+    __atomic_store_n(&maint_stop, true, __ATOMIC_RELEASE);
+    pthread_join(maint_thread, NULL);
+    maint_running = false;
+}
+
+/*
+ * mm_stop_background stops the worker and coalesces the blocks it left
+ * pending. Call it before the heap goes away or is reset.
+ */
+void mm_stop_background(void) {
+    maint_halt();
+    maint_drain(maint_pending_count);
+}
+
+/*
+ * mm_set_background selects a background maintenance worker
+ * for the next heap set up by mm_init
+ */
+void mm_set_background(bool enable) {
+    background = enable;
+}
+
+/*
+ * slab_class returns the slab class serving blocks of asize bytes,
+ * or -1 if slabs don't serve that size
+ */
+static int slab_class(size_t asize) {
+    int index = (int)(asize / dsize) - 2;
+    return (index < slab_classes) ? index : -1;
+}
+
+/*
+ * slab_object returns whether a payload belongs to a slab object
+ */
+static bool slab_object(void *bp) {
+    word_t header = payload_to_header(bp)->header;
+    return (header & (slab_mask | alloc_mask)) == (slab_mask | alloc_mask);
+}
+
+/*
+ * slab_pop takes the top object off a class's free stack, or NULL
+ */
+static block_t *slab_pop(int index) {
+    uint64_t head = __atomic_load_n(&slab_heads[index], __ATOMIC_ACQUIRE);
+    uint64_t next;
+    block_t *block;
+
+    do {
+        block = (block_t *)(head & slab_ptr_mask);
+        if (block == NULL) {
+            return NULL;
+        }
+        //The object may already be gone again; the tag check catches it
+        next = (uint64_t)__atomic_load_n(&NBLOCK, __ATOMIC_RELAXED);
+        next |= ((head >> slab_tag_shift) + 1) << slab_tag_shift;
+    } while (!__atomic_compare_exchange_n(&slab_heads[index], &head, next,
+                 true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return block;
+}
+
+/*
+ * slab_push puts a chain of objects, linked from first to last,
+ * on top of a class's free stack
+ */
+static void slab_push(int index, block_t *first, block_t *last) {
+    uint64_t head = __atomic_load_n(&slab_heads[index], __ATOMIC_RELAXED);
+    uint64_t top;
+
+    do {
+        __atomic_store_n(&last->block_payload.block_ties.next,
+                         (block_t *)(head & slab_ptr_mask), __ATOMIC_RELAXED);
+        top = (uint64_t)first;
+        top |= ((head >> slab_tag_shift) + 1) << slab_tag_shift;
+    } while (!__atomic_compare_exchange_n(&slab_heads[index], &head, top,
+                 true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * slab_page returns the first word of the page holding a slab object:
+ * its owner, if any, with the class in the low bits
+ */
+static word_t slab_page(block_t *block) {
+    block_t *page = (block_t *)((char *)block - get_size(block));
+    return *(word_t *)header_to_payload(page);
+}
+
+/*
+ * slab_carve cuts a new page from the heap into objects of a class,
+ * linked from the returned first object to *last. Returns NULL if
+ * the heap is full.
+ */
+static block_t *slab_carve(int index, slab_owner_t *owner, block_t **last) {
+    size_t osize = (size_t)(index + 2) * dsize;
+    size_t offset, end;
+    bool locked = false;
+    word_t *payload;
+    block_t *page, *first, *block = NULL;
+
+    if (owner != NULL) {
+        //Owners carve pages out of their thread's own reservation
+        //above the heap, without the lock; the heap later steps over
+        //them with a gap block. The page header word is unused.
+        char *area = mem_sbrk_local(slab_page_size);
+        if (area == (void *)-1) {
+            return NULL;
+        }
+        page = (block_t *)(area + wsize);
+        end = slab_page_size - wsize;
+    } else {
+        locked = heap_lock();
+        if ((payload = allocate(slab_page_size - wsize)) == NULL) {
+            heap_unlock(locked);
+            return NULL;
+        }
+        page = payload_to_header(payload);
+        end = get_size(page);
+    }
+    payload = header_to_payload(page);
+    payload[0] = (word_t)owner | (word_t)index;
+    //Object headers start right after the class word
+    first = (block_t *)(payload + 1);
+    for (offset = (char *)first - (char *)page; offset + osize <= end;
+            offset += osize) {
+        block_t *next = (block_t *)((char *)page + offset);
+        next->header = offset | slab_mask | alloc_mask;
+        if (block != NULL) {
+            NBLOCK = next;
+        }
+        block = next;
+    }
+    block->block_payload.block_ties.next = NULL;
+    __atomic_add_fetch(&slab_pages, 1, __ATOMIC_RELAXED);
+    heap_unlock(locked);
+    *last = block;
+    return first;
+}
+
+/*
+ * slab_refill carves a new page for a shared class and pushes all its
+ * objects on the class's stack. Returns false if the heap is full.
+ */
+static bool slab_refill(int index) {
+    block_t *last;
+    block_t *first = slab_carve(index, NULL, &last);
+
+    if (first == NULL) {
+        return false;
+    }
+    slab_push(index, first, last);
+    return true;
+}
+
+/*
+ * slab_alloc returns an object for a request of size bytes,
+ * or NULL if slabs don't serve that size or the heap is full
+ */
+static void *slab_alloc(size_t size) {
+    size_t asize = max(round_up(size + wsize, dsize), min_block_size);
+    int index = slab_class(asize);
+    slab_owner_t *owner;
+    block_t *block;
+
+    if (size == 0 || index < 0) {
+        return NULL;
+    }
+    if (owned_active) {
+        owner = owner_get();
+        return (owner != NULL) ? owner_alloc(owner, index) : NULL;
+    }
+    while ((block = slab_pop(index)) == NULL) {
+        if (!slab_refill(index)) {
+            return NULL;
+        }
+    }
+    return header_to_payload(block);
+}
+
+/*
+ * slab_free returns an object to its owner, or to the stack of its
+ * page's class if the page is shared
+ */
+static void slab_free(void *bp) {
+    block_t *block = payload_to_header(bp);
+    word_t page = slab_page(block);
+    slab_owner_t *owner = (slab_owner_t *)(page & size_mask);
+
+    if (owner != NULL) {
+        owner_free(owner, block);
+    } else {
+        slab_push((int)(page & ~size_mask), block, block);
+    }
+}
+
+/*
+ * slab_realloc moves a slab object's data to a block of size bytes
+ */
+static void *slab_realloc(void *ptr, size_t size) {
+    int index = (int)(slab_page(payload_to_header(ptr)) & ~size_mask);
+    size_t copysize = (size_t)(index + 2) * dsize - wsize;
+    void *newptr;
+
+    if (size == 0) {
+        slab_free(ptr);
+        return NULL;
+    }
+    if ((newptr = malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(newptr, ptr, (size < copysize) ? size : copysize);
+    slab_free(ptr);
+    return newptr;
+}
+
+/*
+ * owner_key_init creates the key that tells owners their thread exited,
+ * the first time owned heaps are used
+ */
+static void owner_key_init(void) {
+    if (owner_key_ready) {
+        return;
+    }
+    owner_key_ready = (pthread_key_create(&owner_key, owner_exit) == 0);
+}
+
+/*
+ * owner_exit marks the owner of an exiting thread idle, so that another
+ * thread can adopt it, unless it belongs to a heap since replaced
+ */
+static void owner_exit(void *owner) {
+    if (owner == thread_owner && thread_epoch == heap_epoch) {
+        __atomic_store_n(&thread_owner->idle, true, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * owner_get returns the calling thread's owner in this heap, adopting
+ * an idle one or setting one up on its first small malloc. Returns NULL
+ * if the heap is full.
+ */
+static slab_owner_t *owner_get(void) {
+    slab_owner_t *owner;
+    bool locked;
+
+    if (thread_owner != NULL && thread_epoch == heap_epoch) {
+        return thread_owner;
+    }
+    locked = heap_lock();
+    //Owners only go idle, never back, outside the lock
+    for (owner = slab_owners; owner != NULL; owner = owner->next) {
+        if (__atomic_load_n(&owner->idle, __ATOMIC_ACQUIRE)) {
+            owner->idle = false;
+            break;
+        }
+    }
+    if (owner == NULL && (owner = allocate(sizeof(slab_owner_t))) != NULL) {
+        memset(owner, 0, sizeof(slab_owner_t));
+        owner->next = slab_owners;
+        slab_owners = owner;
+    }
+    if (owner != NULL) {
+        thread_owner = owner;
+        thread_epoch = heap_epoch;
+        if (owner_key_ready) {
+            pthread_setspecific(owner_key, owner);
+        }
+    }
+    heap_unlock(locked);
+    return owner;
+}
+
+/*
+ * owner_drain takes everything other threads freed to an owner
+ * and sorts it into the owner's own lists
+ */
+static void owner_drain(slab_owner_t *owner) {
+    block_t *block = __atomic_exchange_n(&owner->remote, NULL,
+                                         __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        block_t *next = NBLOCK;
+        int index = (int)(slab_page(block) & ~size_mask);
+        NBLOCK = owner->local[index];
+        owner->local[index] = block;
+        owner->remote_frees++;
+        block = next;
+    }
+}
+
+/*
+ * owner_alloc pops an object of a class off the calling thread's
+ * own lists, carving a new page once they and its remote stack are empty
+ */
+static void *owner_alloc(slab_owner_t *owner, int index) {
+    block_t *block;
+
+    if (__atomic_load_n(&owner->remote, __ATOMIC_RELAXED) != NULL) {
+        owner_drain(owner);
+    }
+    block = owner->local[index];
+    if (block == NULL) {
+        block_t *last;
+        if ((block = slab_carve(index, owner, &last)) == NULL) {
+            return NULL;
+        }
+    }
+    owner->local[index] = NBLOCK;
+    return header_to_payload(block);
+}
+
+/*
+ * owner_free hands an object back to the owner of its page: straight
+ * onto its list from the owner itself, or onto its remote stack
+ */
+static void owner_free(slab_owner_t *owner, block_t *block) {
+    block_t *head;
+
+    if (owner == thread_owner && thread_epoch == heap_epoch) {
+        int index = (int)(slab_page(block) & ~size_mask);
+        NBLOCK = owner->local[index];
+        owner->local[index] = block;
+        return;
+    }
+    head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+    do {
+        NBLOCK = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote, &head, block,
+                 true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * mm_set_owned_heaps gives each thread its own slabs, with remote-free
+ * stacks for cross-thread frees, in the next heap set up by mm_init
+ */
+void mm_set_owned_heaps(bool enable) {
+    owned = enable;
+}
+
+/*
+ * mm_owned_stats returns the number of slab owners in the heap, idle
+ * ones included, and how many of their objects other threads freed
+ */
+size_t mm_owned_stats(size_t *remote_frees) {
+    size_t owners = 0;
+    slab_owner_t *owner;
+
+    *remote_frees = 0;
+    for (owner = slab_owners; owner != NULL; owner = owner->next) {
+        owners++;
+        *remote_frees += owner->remote_frees;
+    }
+    return owners;
+}
+
+/*
+ * mm_set_slab selects lock-free slabs for the smallest blocks
+ * of the next heap set up by mm_init
+ */
+void mm_set_slab(bool enable) {
+    slab = enable;
+}
+
+/*
+ * mm_slab_stats returns the number of slab pages carved since mm_init
+ */
+size_t mm_slab_stats(void) {
+    return slab_pages;
+}
+
+/*
+ * fine_init sets up the fine-grained locks the first time they're needed
+ */
+static void fine_init(void) {
+    int i;
+    if (fine_ready) {
+        return;
+    }
+    pthread_mutex_init(&fine_boundary, NULL);
+    for (i = 0; i < seg_size; i++) {
+        pthread_mutex_init(&fine_class[i], NULL);
+    }
+    fine_ready = true;
+}
+
+/*
+ * fine_lock_all takes the boundary lock and then every class lock
+ * in order, shutting every other thread out of the heap
+ */
+static void fine_lock_all(void) {
+    int i;
+    pthread_mutex_lock(&fine_boundary);
+    for (i = 0; i < seg_size; i++) {
+        pthread_mutex_lock(&fine_class[i]);
+    }
+}
+
+/*
+ * fine_unlock_all releases what fine_lock_all took
+ */
+static void fine_unlock_all(void) {
+    int i;
+    for (i = seg_size - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&fine_class[i]);
+    }
+    pthread_mutex_unlock(&fine_boundary);
+}
+
+/*
+ * fine_fit takes the first free block of at least asize bytes off
+ * the lists, one class lock at a time, and marks it allocated.
+ * Returns NULL if there is none.
+ */
+static block_t *fine_fit(size_t asize) {
+    int index;
+    block_t *block;
+
+    for (index = sizeIndex(asize); index < seg_size; index++) {
+        pthread_mutex_lock(&fine_class[index]);
+        for (block = segregrated_list[index]; block != NULL;
+                block = block->block_payload.block_ties.next) {
+            if (asize <= get_size(block)) {
+                deletion(block);
+                block->header = (block->header & ~zero_mask) | alloc_mask;
+                pthread_mutex_unlock(&fine_class[index]);
+                return block;
+            }
+        }
+        pthread_mutex_unlock(&fine_class[index]);
+    }
+    return NULL;
+}
+
+/*
+ * fine_grow extends the heap with every lock held, and takes a block
+ * of at least asize bytes from the new space like fine_fit
+ */
+static block_t *fine_grow(size_t asize) {
+    block_t *block;
+
+    fine_lock_all();
+    block = extend_heap(max(asize, chunksize));
+    if (block != NULL) {
+        deletion(block);
+        block->header = (block->header & ~zero_mask) | alloc_mask;
+    }
+    fine_unlock_all();
+    return block;
+}
+
+/*
+ * fine_set_prev sets or clears the bit recording whether the block
+ * before this one is allocated. If the block is free, malloc may be
+ * taking it at the same time, so the class lock is held for the change.
+ */
+static void fine_set_prev(block_t *block, bool alloc) {
+    pthread_mutex_t *lock = NULL;
+
+    if (!get_alloc(block)) {
+        lock = &fine_class[sizeIndex(get_size(block))];
+        pthread_mutex_lock(lock);
+    }
+    if (alloc) {
+        block->header |= alloc_bit;
+    } else {
+        block->header &= ~alloc_bit;
+    }
+    if (lock != NULL) {
+        pthread_mutex_unlock(lock);
+    }
+}
+
+/*
+ * fine_claim takes a neighbour off its list for coalescing, if it
+ * is still free. Returns the neighbour, or NULL if malloc got there first.
+ */
+static block_t *fine_claim(block_t *block) {
+    pthread_mutex_t *lock = &fine_class[sizeIndex(get_size(block))];
+    bool free_block;
+
+    pthread_mutex_lock(lock);
+    free_block = !get_alloc(block);
+    if (free_block) {
+        deletion(block);
+    }
+    pthread_mutex_unlock(lock);
+    return free_block ? block : NULL;
+}
+
+/*
+ * fine_coalesce merges a free block, not yet on a list, with whichever
+ * neighbours are still free, and puts the result on its list.
+ * Must be called with fine_boundary held.
+ */
+static void fine_coalesce(block_t *block) {
+    size_t size = get_size(block);
+    word_t extract = block->header & alloc_bit;
+    block_t *next = find_next(block);
+    block_t *previous;
+    pthread_mutex_t *lock;
+
+    //A block malloc took but hasn't placed yet still has its footer,
+    //and fine_claim sees it's allocated
+    if (!extract && (previous = fine_claim(find_prev(block))) != NULL) {
+        size += get_size(previous);
+        extract = previous->header & alloc_bit;
+        block = previous;
+    }
+    if (!get_alloc(next) && fine_claim(next) != NULL) {
+        size += get_size(next);
+    } else {
+        fine_set_prev(next, false);
+    }
+    write_header(block, size | extract, false);
+    write_footer(block, size | extract, false);
+    lock = &fine_class[sizeIndex(size)];
+    pthread_mutex_lock(lock);
+    insertion(block, size);
+    pthread_mutex_unlock(lock);
+}
+
+/*
+ * fine_place finishes allocating asize bytes at the start of a block
+ * fine_fit or fine_grow took, freeing the rest if it's big enough
+ */
+static void fine_place(block_t *block, size_t asize) {
+    size_t csize = get_size(block);
+    word_t extract;
+
+    pthread_mutex_lock(&fine_boundary);
+    //A neighbour freed meanwhile may have changed this
+    extract = block->header & alloc_bit;
+    if ((csize - asize) >= min_block_size) {
+        block_t *block_next;
+        block->header = pack(asize, true) | extract;
+        block_next = find_next(block);
+        block_next->header = pack(csize - asize, false) | alloc_bit;
+        fine_coalesce(block_next);
+    } else {
+        block->header = pack(csize, true) | extract;
+        fine_set_prev(find_next(block), true);
+    }
+    pthread_mutex_unlock(&fine_boundary);
+}
+
+/*
+ * fine_malloc allocates like malloc, under fine-grained locks
+ */
+static void *fine_malloc(size_t size) {
+    size_t asize;
+    block_t *block;
+
+    if (size == 0) {
+        return NULL;
+    }
+    asize = max(round_up(size + wsize, dsize), min_block_size);
+    if ((block = fine_fit(asize)) == NULL
+            && (block = fine_grow(asize)) == NULL) {
+        return NULL;
+    }
+    fine_place(block, asize);
+    return header_to_payload(block);
+}
+
+/*
+ * fine_free frees like free, under fine-grained locks
+ */
+static void fine_free(void *bp) {
+    block_t *block;
+
+    if (bp == NULL) {
+        return;
+    }
+    block = payload_to_header(bp);
+    pthread_mutex_lock(&fine_boundary);
+    block->header = pack(get_size(block), false) | (block->header & alloc_bit);
+    fine_coalesce(block);
+    pthread_mutex_unlock(&fine_boundary);
+}
+
+/*
+ * mm_set_fine_locks selects per-class locks, in place of one heap
+ * lock, for the next heap set up by mm_init
+ */
+void mm_set_fine_locks(bool enable) {
+    fine_locks = enable;
+}
+
+/*
+ * mm_fine_locks returns whether per-class locks guard the heap,
+ * which needs the other policies off
+ */
+bool mm_fine_locks(void) {
+    return fine_active;
+}
+
+/*
+ * outside_state_policies returns whether a requested policy keeps heap
+ * state outside the heap, where a reopened heap can't find it
+ */
+static bool outside_state_policies(void) {
+    return side_table
+           || exact_cache
+           || lifetime
+           || background
+           || slab
+           || owned;
+}
+
+/*
+ * single_threaded_policies returns whether a policy in force for the
+ * next heap assumes a single thread in it, which rules out fine locks
+ */
+static bool single_threaded_policies(void) {
+    return side_table
+           || exact_cache
+           || coloring
+           || huge_align
+           || remapping
+           || lifetime
+           || soft_limit != 0
+           || purging
+           || background
+           || slab_active
+           || persist_active;
+}
+
+/*
+ * This function initializes the heap.
+ * The main purpose is to initialize all 
+ * of the buckets of segregated list to <NULL>
+ */
+bool mm_init(void)
+{
+    // Create the initial empty heap
+    dbg_printf("\nINIT"); 
+    // The worker of an earlier heap must be gone before it's replaced
+    maint_halt();
+    persist_active = persistent && !outside_state_policies();
+    word_t *start = (word_t *)(mem_sbrk(persist_header_size() + 2*wsize));
+
+    if (start == (void *)-1)
+    {
+        return false;
+    }
+
+    // A persistent heap's header goes first, marked dirty until
+    // the first checkpoint
+    persist_header = NULL;
+    if (persist_active)
+    {
+        persist_header = (persist_header_t *)start;
+        persist_header->magic = persist_magic;
+        persist_header->state = persist_dirty;
+        start = (word_t *)((char *)start + persist_header_size());
+    }
+
+    //Prologue footer, bitwise or with the alloc bit
+    start[0] = pack(0, true)|alloc_bit;
+    //Epilogue header, bitwise or with the alloc bit
+    start[1] = pack(0, true)|alloc_bit;
+
+    // Heap starts with first "block header", 
+    //currently the epilogue footer
+    heap_start = (block_t *) &(start[1]);
+    heap_end = heap_start;
+    reset_heap_state();
+
+    // Extend the empty heap with a free block of chunksize bytes
+    if (extend_heap(chunksize) == NULL)
+    {
+        return false;
+    }
+    if (background)
+    {
+        maint_start();
+    }
+    return true;
+}
+
+/*
+ * reset_heap_state empties the free lists and sets up the policies'
+ * state for a heap that mm_init or mm_reopen is starting on
+ */
+static void reset_heap_state(void)
+{
+    int i;
+
+    //Initialize the free list to start with NULL
+    //Initialize each bucket in the seg list to start with NULL
+    for (i = 0; i < seg_size; i++) {
+        segregrated_list[i] = NULL;
+        side_count[i] = 0;
+        color_next[i] = 0;
+        nursery_list[i] = NULL;
+        life_avg[i] = 0;
+        life_samples[i] = 0;
+    }
+    life_avg_all = 0;
+    nursery_lo = NULL;
+    nursery_hi = NULL;
+    nursery_next = nursery_min_size;
+    nursery_live = 0;
+    heap_limit = soft_limit;
+    compact = false;
+    purge_clock = 0;
+    purged_bytes = 0;
+    remapped_bytes = 0;
+    page_size = mem_pagesize();
+    maint_pending = NULL;
+    maint_pending_count = 0;
+    for (i = 0; i < slab_classes; i++) {
+        slab_heads[i] = 0;
+    }
+    slab_pages = 0;
+    slab_owners = NULL;
+    heap_epoch++;
+    owned_active = owned;
+    slab_active = slab || owned;
+    if (slab_active) {
+        heap_mutex_init();
+    }
+    if (owned_active) {
+        owner_key_init();
+    }
+    fine_active = fine_locks && !single_threaded_policies();
+    if (fine_active) {
+        fine_init();
+    }
+    nursery_allocs = 0;
+    life_allocs = 0;
+    life_clock = 0;
+    for (i = 0; i < life_table_size; i++) {
+        life_table[i].block = NULL;
+    }
+    //Without the arrays, free blocks stay on the segregated lists
+    side_active = side_table && side_map();
+    if (side_active && side_best == NULL) {
+        side_best = side_pick_kernel();
+    }
+
+    //Start every heap with an empty exact-size cache
+    for (i = 0; i < exact_slots; i++) {
+        exact_table[i].size = 0;
+        exact_table[i].top = NULL;
+        exact_table[i].count = 0;
+    }
+    exact_active = exact_cache;
+    exact_lookups = 0;
+    exact_hits = 0;
+    exact_window_lookups = 0;
+    exact_window_hits = 0;
+}
+
+/*
+ * mm_reopen takes over the heap whose header is at memlib's break, as
+ * the last mm_checkpoint of a persistent heap left it, in place of
+ * mm_init, and without walking its blocks. Returns false, with
+ * memlib's heap empty again, if the heap isn't persistent, changed
+ * after its checkpoint, or was laid out at another address.
+ */
+bool mm_reopen(void)
+{
+    persist_header_t *header;
+    size_t size;
+    int i;
+
+    maint_halt();
+    persist_active = persistent && !outside_state_policies();
+    if (!persist_active)
+    {
+        return false;
+    }
+    header = (persist_header_t *)mem_sbrk(persist_header_size());
+    if (header == (void *)-1)
+    {
+        persist_active = false;
+        return false;
+    }
+    size = header->heap_size;
+    if (header->magic != persist_magic || header->state != persist_clean
+            || header->base != (word_t)header
+            || header->checksum != persist_checksum(header)
+            || size < persist_header_size() + min_block_size
+            || (char *)header->heap_end <= (char *)header
+            || (char *)header->heap_end >= (char *)header + size
+            || mem_sbrk(size - persist_header_size()) == (void *)-1)
+    {
+        mem_reset_brk();
+        persist_active = false;
+        return false;
+    }
+
+    persist_header = header;
+    heap_start = (block_t *)((char *)header + persist_header_size() + wsize);
+    heap_end = header->heap_end;
+    reset_heap_state();
+    for (i = 0; i < seg_size; i++) {
+        segregrated_list[i] = header->roots[i];
+    }
+    compact = header->compact;
+    return true;
+}
+
+/*
+ * mm_checkpoint records the free lists in a persistent heap's header,
+ * writes the heap back to memlib's file, and marks the header clean.
+ * Returns false if the heap isn't persistent or couldn't be written.
+ */
+bool mm_checkpoint(void)
+{
+    bool locked = heap_lock();
+    bool ok = persist_active;
+    int i;
+
+    if (ok)
+    {
+        persist_header->state = persist_dirty;
+        persist_header->base = (word_t)persist_header;
+        persist_header->heap_size = mem_heapsize();
+        persist_header->heap_end = heap_end;
+        persist_header->compact = compact;
+        for (i = 0; i < seg_size; i++) {
+            persist_header->roots[i] = segregrated_list[i];
+        }
+        persist_header->checksum = persist_checksum(persist_header);
+        // The header may only say clean once the blocks it points
+        // to are written
+        ok = mem_sync();
+        if (ok)
+        {
+            persist_header->state = persist_clean;
+            ok = mem_sync();
+        }
+    }
+    heap_unlock(locked);
+    return ok;
+}
+
+/*
+ * mm_set_persistent selects keeping a header that mm_reopen can take
+ * the heap over from
+ */
+void mm_set_persistent(bool enable) {
+    persistent = enable;
+}
+
+/*
+ * persist_header_size returns the bytes the header takes at the start
+ * of the heap, keeping the blocks after it aligned
+ */
+static size_t persist_header_size(void) {
+    return persist_active ? round_up(sizeof(persist_header_t), dsize) : 0;
+}
+
+/*
+ * persist_checksum hashes the header's fields after the checksum
+ */
+static word_t persist_checksum(persist_header_t *header) {
+    const char *field = (const char *)&header->base;
+    const char *end = (const char *)(header + 1);
+    word_t sum = 0xcbf29ce484222325;  //FNV-1a, a word at a time
+    word_t word;
+
+    for (; field < end; field += sizeof(word_t)) {
+        memcpy(&word, field, sizeof(word_t));
+        sum = (sum ^ word) * 0x100000001b3;
     }
-    //Case 4: If both the next and previous pointers exist, 
-    //then we need to remove the block between them.
-    if (block_next != NULL && block_previous != NULL) {
-        block_previous->block_payload.block_ties.next = block_next;
-        block_next->block_payload.block_ties.previous = block_previous;
-        return;
+    return sum;
+}
+
+/*
+ * persist_touch marks a persistent heap's header dirty before the
+ * heap first changes after a checkpoint
+ */
+static void persist_touch(void) {
+    if (persist_active && persist_header->state != persist_dirty) {
+        persist_header->state = persist_dirty;
     }
 }
 
 /*
- * This function initializes the heap.
- * The main purpose is to initialize all 
- * of the buckets of segregated list to <NULL>
+ * malloc, free, realloc and mm_malloc_flags hold the heap lock around
+ * the work, while a background worker runs or slabs are on
  */
-bool mm_init(void)
+void *malloc(size_t size)
 {
-    // Create the initial empty heap
-    dbg_printf("\nINIT"); 
-    word_t *start = (word_t *)(mem_sbrk(2*wsize));
-    int i;
+    bool locked;
+    void *bp;
 
-    if (start == (void *)-1)
+    // Small blocks come off a slab without taking the lock
+    if (slab_active && (bp = slab_alloc(size)) != NULL)
     {
-        return false;
+        return bp;
+    }
+    if (fine_active)
+    {
+        return fine_malloc(size);
     }
+    locked = heap_lock();
+    bp = allocate(size);
+    heap_unlock(locked);
+    return bp;
+}
 
-    //Prologue footer, bitwise or with the alloc bit
-    start[0] = pack(0, true)|alloc_bit;
-    //Epilogue header, bitwise or with the alloc bit
-    start[1] = pack(0, true)|alloc_bit;
+void *mm_malloc_flags(size_t size, int flags)
+{
+    bool locked = heap_lock();
+    void *bp = allocate_flags(size, flags);
+    heap_unlock(locked);
+    return bp;
+}
 
-    // Heap starts with first "block header", 
-    //currently the epilogue footer
-    heap_start = (block_t *) &(start[1]);
+void free(void *bp)
+{
+    bool locked;
 
-    //Initialize the free list to start with NULL
-    //Initialize each bucket in the seg list to start with NULL
-    for (i = 0; i < seg_size; i++) {
-        segregrated_list[i] = NULL;
+    if (slab_active && bp != NULL && slab_object(bp))
+    {
+        slab_free(bp);
+        return;
     }
+    if (fine_active)
+    {
+        fine_free(bp);
+        return;
+    }
+    locked = heap_lock();
+    deallocate(bp);
+    heap_unlock(locked);
+}
 
-    // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL)
+void *realloc(void *ptr, size_t size)
+{
+    bool locked;
+    void *newptr;
+
+    if (slab_active && ptr != NULL && slab_object(ptr))
     {
-        return false;
+        return slab_realloc(ptr, size);
     }
-    return true;
+    locked = heap_lock();
+    newptr = reallocate(ptr, size);
+    heap_unlock(locked);
+    return newptr;
 }
 
 /*
@@ -349,12 +2909,11 @@ bool mm_init(void)
  * extendHeap is called and more memory is allocated.
  * All allocated blocks will not be available until they are freed
  */
-void *malloc(size_t size) 
+static void *allocate(size_t size) 
 {
     dbg_printf("\nMALLOC");
     dbg_requires(mm_checkheap(__LINE__));
     size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
     block_t *block;
     void *bp = NULL;
 
@@ -368,37 +2927,194 @@ void *malloc(size_t size)
         dbg_ensures(mm_checkheap(__LINE__));
         return bp;
     }
+    persist_touch();
 
     // Adjust block size to include overhead 
     // and to meet alignment requirements
     asize = max(round_up(size + wsize, dsize), min_block_size);
 
-    // Search the free list for a fit
-    block = find_fit(asize);
+    // Reuse a cached block of exactly this size if there is one;
+    // larger sizes are never cached, so they neither look nor count
+    if (exact_active && asize <= exact_max_size
+            && (block = exact_pop(asize)) != NULL)
+    {
+        if (lifetime)
+        {
+            life_track(block, asize);
+        }
+        bp = header_to_payload(block);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+
+    // Start huge blocks on a huge page, place blocks predicted to die
+    // young in the nursery, and search the free list for all others
+    block = NULL;
+    if (huge_align && !compact && asize >= huge_size)
+    {
+        block = aligned_fit(asize, huge_size);
+        if (block == NULL)
+        {
+            return bp;
+        }
+    }
+    // Large blocks start on a page, so realloc can remap them
+    if (block == NULL && remapping && !compact && asize >= remap_min_size)
+    {
+        block = aligned_fit(asize, page_size);
+        if (block == NULL)
+        {
+            return bp;
+        }
+    }
+    if (block == NULL && lifetime && !compact && life_is_short(asize))
+    {
+        block = nursery_fit(asize);
+    }
+    if (block == NULL)
+    {
+        block = find_fit(asize);
+    }
 
     // If no fit is found, request more memory, and then and place the block
     if (block == NULL)
     {  
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
+        block = grow_heap(asize);
         if (block == NULL) // extend_heap returns an error
         {
             return bp;
         }
+        // Stagger where each new run of small blocks starts
+        if (coloring && !compact && asize <= color_max_size)
+        {
+            block = color_run(block, asize);
+        }
 
     }
     place(block, asize);
+    if (lifetime)
+    {
+        life_track(block, asize);
+    }
     bp = header_to_payload(block);
     dbg_printf("\nMALLOCing SIZE: %lx", asize);
     dbg_ensures(mm_checkheap(__LINE__));
     return bp;
     } 
 
+/*
+ * allocate_flags allocates like malloc, but lets the caller's hints
+ * pick the search and placement. Blocks from here bypass the exact-size
+ * cache and the nursery, and are freed and reallocated as usual.
+ */
+static void *allocate_flags(size_t size, int flags)
+{
+    dbg_printf("\nMALLOC FLAGS %x", flags);
+    size_t asize;      // Adjusted block size
+    size_t bsize;      // Size of the block to hand out
+    block_t *block = NULL;
+    bool zeroed;
+    size_t purged = 0; // Bytes of purged pages in the block
+    char *lo = NULL;   // First of those pages
+    void *bp;
+
+    if (flags == 0)
+    {
+        return allocate(size);
+    }
+    if (heap_start == NULL)
+    {
+        mm_init();
+    }
+    if (size == 0)
+    {
+        return NULL;
+    }
+    dbg_requires(mm_checkheap(__LINE__));
+    persist_touch();
+
+    asize = max(round_up(size + wsize, dsize), min_block_size);
+    // Reserve as much again for realloc to grow into
+    bsize = ((flags & MM_GROW) && !compact) ? 2 * asize : asize;
+
+    if (flags & MM_ALIGN_LINE)
+    {
+        block = aligned_fit(bsize, color_line);
+    }
+    else
+    {
+        if (flags & MM_ZERO)
+        {
+            block = zero_fit(bsize);
+        }
+        if (block == NULL && (flags & (MM_LONG_LIVED | MM_NO_SPLIT)))
+        {
+            block = best_fit(bsize);
+        }
+        if (block == NULL)
+        {
+            block = find_fit(bsize);
+        }
+        if (block == NULL)
+        {
+            block = grow_heap(bsize);
+        }
+    }
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    // A block at most twice the request is handed over whole
+    if ((flags & MM_NO_SPLIT) && !compact && get_size(block) <= 2 * bsize)
+    {
+        bsize = get_size(block);
+    }
+    zeroed = get_zeroed(block);
+    if (get_purged(block))
+    {
+        purged = purge_pages(block, &lo);
+    }
+    place(block, bsize);
+    if (bsize > asize && (flags & MM_GROW))
+    {
+        block->header |= grow_mask;
+    }
+    if (lifetime)
+    {
+        life_track(block, asize);
+    }
+    bp = header_to_payload(block);
+
+    // A known-zero block only has its links, stamp and footer to clear,
+    // and a purged block only what lies outside its purged pages
+    if (flags & MM_ZERO)
+    {
+        if (zeroed)
+        {
+            memset(bp, 0, dsize + wsize);
+            memset((char *)block + get_size(block) - wsize, 0, wsize);
+        }
+        else if (purged > 0 && lo + purged >= (char *)bp + size)
+        {
+            memset(bp, 0, (lo < (char *)bp + size)
+                   ? (size_t)(lo - (char *)bp) : size);
+            memset((char *)block + get_size(block) - wsize, 0, wsize);
+        }
+        else
+        {
+            memset(bp, 0, size);
+        }
+    }
+    dbg_ensures(mm_checkheap(__LINE__));
+    return bp;
+}
+
 /*
  * The Free method frees blocks that are to be deallocated
  * The blocks that are freed are available to malloc()
  */
-void free(void *bp)
+static void deallocate(void *bp)
 {
     dbg_printf("\nFREE");
     if (bp == NULL)
@@ -407,6 +3123,38 @@ void free(void *bp)
     }
 
     block_t *block = payload_to_header(bp);
+    persist_touch();
+    if (lifetime)
+    {
+        life_observe(block);
+    }
+    //Every so often, purge the pages of blocks that stay free,
+    //unless the worker does it
+    if (purging && ++purge_clock % purge_interval == 0 && !maint_running)
+    {
+        purge_pass();
+    }
+    //Keep blocks of repeated sizes for the next malloc of that size
+    if (exact_active && exact_push(block))
+    {
+        return;
+    }
+    //Leave the coalescing to the worker
+    if (maint_running && maint_pending_count < maint_pending_max)
+    {
+        block->block_payload.block_ties.next = maint_pending;
+        maint_pending = block;
+        maint_pending_count++;
+        return;
+    }
+    release(block);
+}
+
+/*
+ * release marks an allocated block free and coalesces it into the heap
+ */
+static void release(block_t *block)
+{
     size_t size = get_size(block);
     //Find the alloc bit
     int extract = (block->header) & alloc_bit; 
@@ -418,7 +3166,11 @@ void free(void *bp)
     //Clear alloc bit flag for free
     next_block->header = next_block->header & (~alloc_bit); 
 
-    coalesce(block);
+    block = coalesce(block);
+    if (compact)
+    {
+        trim_heap(block);
+    }
 
 }
 
@@ -428,28 +3180,51 @@ void free(void *bp)
  * if the pointer is null, we malloc size
  * if the new pointer is null, we return null
  */
-void *realloc(void *ptr, size_t size)
+static void *reallocate(void *ptr, size_t size)
 {
     dbg_printf("\nREALLOC");
     block_t *block = payload_to_header(ptr);
+    size_t asize;
     size_t copysize;
+    size_t head;       // Bytes before the first page of a remap
+    size_t moved;      // Bytes moved by remapping pages
     void *newptr;
 
     // If size == 0, then free block and return NULL
     if (size == 0)
     {
-        free(ptr);
+        deallocate(ptr);
         return NULL;
     }
 
     // If ptr is NULL, then equivalent to malloc
     if (ptr == NULL)
     {
-        return malloc(size);
+        return allocate(size);
+    }
+    persist_touch();
+
+    // Keep the slack of a block allocated with MM_GROW as long as at
+    // least half of it stays in use, outside compact mode. Any other
+    // block that shrinks splits off its tail, as malloc would, and a
+    // block that grows takes over a free block that follows if there is one
+    asize = max(round_up(size + wsize, dsize), min_block_size);
+    if (asize <= get_size(block))
+    {
+        if (compact || !(block->header & grow_mask)
+                || get_size(block) > 2 * asize)
+        {
+            shrink_in_place(block, asize);
+        }
+        return ptr;
+    }
+    if (grow_in_place(block, asize))
+    {
+        return ptr;
     }
 
     // Otherwise, proceed with reallocation
-    newptr = malloc(size);
+    newptr = allocate(size);
     // If malloc fails, the original block is left untouched
     if (newptr == NULL)
     {
@@ -462,10 +3237,27 @@ void *realloc(void *ptr, size_t size)
     {
         copysize = size;
     }
+    // Remap the whole pages of a large block whose new payload has the
+    // same offset in its page, and copy only the bytes around them
+    head = 0;
+    moved = 0;
+    if (remapping && copysize >= remap_min_size
+            && ((uintptr_t)newptr - (uintptr_t)ptr) % page_size == 0)
+    {
+        head = round_up((uintptr_t)ptr, page_size) - (uintptr_t)ptr;
+        moved = (copysize - head) & ~(page_size - 1);
+        if (mem_remap((char *)newptr + head, (char *)ptr + head, moved))
+        {
+            remapped_bytes += moved;
+            memcpy((char *)newptr + head + moved, (char *)ptr + head + moved,
+                   copysize - head - moved);
+            copysize = head;
+        }
+    }
     memcpy(newptr, ptr, copysize);
 
     // Free the old block
-    free(ptr);
+    deallocate(ptr);
 
     return newptr;
 }
@@ -486,13 +3278,8 @@ void *calloc(size_t elements, size_t size)
         return NULL;
     }
     
-    bp = malloc(asize);
-    if (bp == NULL)
-    {
-        return NULL;
-    }
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
+    // Zeroes only what a known-zero block doesn't already have at 0
+    bp = mm_malloc_flags(asize, MM_ZERO);
 
     return bp;
 }
@@ -504,13 +3291,46 @@ static block_t *extend_heap(size_t size)
 {
     dbg_printf("\nEXTEND HEAP");
     void *bp;
+    void *zero_lo;
+    bool fresh;
+    bool gap;
 
     // Allocate an even number of words to maintain alignment
     size = round_up(size, dsize);
+    // Another thread may have reserved memory right after the heap,
+    // leaving a gap before the new space; that costs a double word
+    gap = !heap_at_top();
+    if (gap)
+    {
+        size += dsize;
+    }
+    // Memory that no earlier heap has used is still zero
+    zero_lo = mem_zero_lo();
     if ((bp = mem_sbrk(size)) == (void *)-1)
     {
         return NULL;
     }
+    fresh = (char *)bp >= (char *)zero_lo;
+    if (bp != (char *)heap_end + wsize)
+    {
+        // Cover the gap with an allocated block, and start the new
+        // block a word into the new space to keep payloads aligned
+        word_t extract = heap_end->header & alloc_bit;
+        if (!gap)
+        {
+            // Reserved since the check: make it all gap and go again
+            heap_end->header = pack((char *)bp + size - wsize
+                                    - (char *)heap_end, true) | extract;
+            heap_end = (block_t *)((char *)bp + size - wsize);
+            heap_end->header = pack(0, true) | alloc_bit;
+            return extend_heap(size);
+        }
+        heap_end->header = pack((char *)bp + wsize - (char *)heap_end, true)
+                           | extract;
+        bp = (char *)bp + dsize;
+        size -= dsize;
+        payload_to_header(bp)->header = alloc_bit;
+    }
     
     // Initialize free block header/footer 
     block_t *block = payload_to_header(bp);
@@ -520,9 +3340,24 @@ static block_t *extend_heap(size_t size)
     // Create new epilogue header
     block_t *block_next = find_next(block);
     write_header(block_next, 0, true);
+    heap_end = block_next;
 
     // Coalesce in case the previous block was free
-    return coalesce(block);
+    if (!fresh || (!get_previous_allocation(block)
+                && !get_zeroed(find_prev(block))))
+    {
+        return coalesce(block);
+    }
+    // Fresh memory, merged with at most a known-zero block: clear the
+    // old epilogue and the footer before it, and it's all still zero
+    block_next = coalesce(block);
+    if (block_next != block)
+    {
+        ((word_t *)bp)[-1] = 0;
+        ((word_t *)bp)[-2] = 0;
+    }
+    mark_zeroed(block_next);
+    return block_next;
 }
 
 static bool get_previous_allocation(block_t *block) {
@@ -544,6 +3379,11 @@ static block_t *coalesce(block_t *block) //DONE WITH ALLOC BIT
 {
     dbg_printf("\nCOALESCE");
     bool previous_allocation = get_previous_allocation(block);
+    //Under fine-grained locks, a block malloc took but hasn't placed
+    //is marked allocated before its neighbour's bit is
+    if (fine_active && !previous_allocation) {
+        previous_allocation = get_alloc(find_prev(block));
+    }
     bool next_allocation = get_alloc(find_next(block));
     size_t size = get_size(block);
 
@@ -608,6 +3448,7 @@ static void place(block_t *block, size_t asize) //DONE WITH ALLOC BIT
     dbg_printf("\nPlacing Block: %p, of Size: %lx",block, asize);
     size_t csize = get_size(block);
     int extract = (block->header) & alloc_bit;
+    bool zeroed = get_zeroed(block);
 
     if ((csize - asize) >= min_block_size)
     {
@@ -618,6 +3459,11 @@ static void place(block_t *block, size_t asize) //DONE WITH ALLOC BIT
         block_next = find_next(block);
         write_header(block_next, csize-asize+alloc_bit, false);
         write_footer(block_next, csize-asize+alloc_bit, false);
+        // The remainder keeps a zero block's old footer, nothing more
+        if (zeroed)
+        {
+            mark_zeroed(block_next);
+        }
         coalesce(block_next);
     }
 
@@ -641,13 +3487,27 @@ static void place(block_t *block, size_t asize) //DONE WITH ALLOC BIT
  */
 static block_t *find_fit(size_t asize) {
     dbg_printf("\nFinding Fit for Size: %lx", asize);
+    if (compact) {
+        return best_fit(asize);
+    }
+    if (side_active) {
+        return side_find_fit(asize);
+    }
+    return list_fit(segregrated_list, asize);
+}
+
+/*
+ * list_fit runs the first fit / best fit search
+ * described above over one set of segregated lists
+ */
+static block_t *list_fit(block_t **lists, size_t asize) {
     block_t *block;
     block_t *bestblock = NULL;
     int correct_size;
     int i = 0;
     int bfit_thresh = 25;
     for (correct_size = sizeIndex(asize); correct_size != seg_size; correct_size++) {
-        for (block = segregrated_list[correct_size]; block != NULL; 
+        for (block = lists[correct_size]; block != NULL; 
                     block = block->block_payload.block_ties.next) {
              if (!(get_alloc(block)) && (asize <= get_size(block))) {
                 bestblock = block;
@@ -661,7 +3521,7 @@ static block_t *find_fit(size_t asize) {
    if (bestblock == NULL) {
        return NULL;
    }
-   for (block = segregrated_list[correct_size]; block != NULL; 
+   for (block = lists[correct_size]; block != NULL; 
             block = block->block_payload.block_ties.next) {
      if (block->block_payload.block_ties.next == NULL) {
            return bestblock;
@@ -861,6 +3721,14 @@ static void *header_to_payload(block_t *block)
  * Please keep modularity in mind when you're writing the heap checker!
  */
 bool mm_checkheap(int line)
+{
+    bool locked = heap_lock();
+    bool ok = check_heap(line);
+    heap_unlock(locked);
+    return ok;
+}
+
+static bool check_heap(int line)
 {
     block_t *previous;
     block_t *next;
@@ -868,10 +3736,14 @@ bool mm_checkheap(int line)
     block_t *iter;
     dbg_printf("\n\nSegregated List Print Out\n");
     int i;
+    int set;
     //This for loop prints out each bin in the segregated list, 
     //and for each bin, each block located in that bin.
+    //The nursery's lists are checked the same way as the main ones.
+    for (set = 0; set < 2; set++) {
+    block_t **lists = (set == 0) ? segregrated_list : nursery_list;
     for (i = 0; i < seg_size; i++) {
-        start = segregrated_list[i];
+        start = lists[i];
         dbg_printf("\nLIST[%d]: ",i);
         for (iter = start; iter != NULL; iter = next) {
             dbg_printf("pt->%p", iter);
@@ -895,9 +3767,103 @@ bool mm_checkheap(int line)
                 printf("Class Size wrong, as block size isnt in that bucket");
                 return false;
             }
+            if (free_lists(iter) != lists) {
+                printf("Block %p is on the wrong side of the nursery", iter);
+                return false;
+            }
             checkblock(iter);
         }
     }
+    }
+    if (persist_active && persist_header->magic != persist_magic) {
+        printf("Persistent heap header %p was overwritten", persist_header);
+        return false;
+    }
+    //In side-table mode, every record must describe a free block of its
+    //class that knows its own slot
+    if (side_active) {
+        size_t slot;
+        for (i = 0; i < seg_size; i++) {
+            for (slot = 0; slot < side_count[i]; slot++) {
+                iter = side_block(i, slot);
+                if (get_alloc(iter) || iter->block_payload.side_index != slot
+                        || get_size(iter) != (size_t)side_sizes[i][slot] << 4
+                        || sizeIndex(get_size(iter)) != i) {
+                    printf("Side table record %zu of class %d is stale: %p",
+                           slot, i, iter);
+                    return false;
+                }
+                checkblock(iter);
+            }
+        }
+    }
+    //Blocks waiting for the worker must still be marked allocated
+    size_t pending = 0;
+    for (iter = maint_pending; iter != NULL;
+            iter = iter->block_payload.block_ties.next) {
+        if (!get_alloc(iter)) {
+            printf("Pending block %p was coalesced early", iter);
+            return false;
+        }
+        pending++;
+    }
+    if (pending != maint_pending_count) {
+        printf("Pending list holds %zu blocks, not %zu",
+               pending, maint_pending_count);
+        return false;
+    }
+    //Cached blocks must stay allocated and match the size of their slot
+    for (i = 0; i < exact_slots; i++) {
+        size_t count = 0;
+        for (iter = exact_table[i].top; iter != NULL;
+                iter = iter->block_payload.block_ties.next) {
+            if (!get_alloc(iter) || get_size(iter) != exact_table[i].size) {
+                printf("Cached block %p doesn't match its exact-size slot",
+                       iter);
+                return false;
+            }
+            count++;
+        }
+        if (count != exact_table[i].count) {
+            printf("Exact-size slot %d counts %zu blocks but holds %zu",
+                   i, exact_table[i].count, count);
+            return false;
+        }
+    }
+    //Free slab objects must sit in a page of their own class
+    for (i = 0; i < slab_classes; i++) {
+        for (iter = (block_t *)(slab_heads[i] & slab_ptr_mask); iter != NULL;
+                iter = iter->block_payload.block_ties.next) {
+            if (!slab_object(header_to_payload(iter))
+                    || slab_page(iter) != (word_t)i) {
+                printf("Slab object %p isn't in a class %d page", iter, i);
+                return false;
+            }
+        }
+    }
+    //And so must those of owned slabs, in a page of their owner
+    for (slab_owner_t *owner = slab_owners; owner != NULL;
+            owner = owner->next) {
+        for (i = 0; i < slab_classes; i++) {
+            for (iter = owner->local[i]; iter != NULL;
+                    iter = iter->block_payload.block_ties.next) {
+                if (!slab_object(header_to_payload(iter))
+                        || slab_page(iter) != ((word_t)owner | (word_t)i)) {
+                    printf("Slab object %p isn't in a class %d page of %p",
+                           iter, i, owner);
+                    return false;
+                }
+            }
+        }
+        for (iter = owner->remote; iter != NULL;
+                iter = iter->block_payload.block_ties.next) {
+            if ((slab_page(iter) & size_mask) != (word_t)owner) {
+                printf("Remote-freed object %p isn't owned by %p",
+                       iter, owner);
+                return false;
+            }
+        }
+    }
     //This is used to print out all of the blocks in memory from the heap start
     for (next = heap_start; get_size(next) != 0; next = find_next(next)) {
         dbg_printf("%p:\t size: %lx\t alloc: %d\t"
@@ -905,6 +3871,24 @@ bool mm_checkheap(int line)
                    next, get_size(next), get_alloc(next),
                    get_previous_allocation(next),
                    extract_size(*find_prev_footer(next)));
+        if (get_purged(next) && get_alloc(next)) {
+            printf("Allocated block %p is marked purged", next);
+            return false;
+        }
+        //On an allocated block the bit is grow_mask instead; a
+        //known-zero free block may only have its links, stamp and
+        //footer set
+        if (!get_alloc(next) && get_zeroed(next)) {
+            char *byte = next->block_payload.payload + dsize + wsize;
+            char *end = (char *)next + get_size(next) - wsize;
+            for (; byte < end; byte++) {
+                if (*byte != 0) {
+                    printf("Block %p is marked zero but byte %p isn't",
+                           next, byte);
+                    return false;
+                }
+            }
+        }
     }
     return true;
 }
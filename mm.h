@@ -19,7 +19,82 @@ extern void *calloc (size_t nmemb, size_t size);
 
 #endif
 
+/* Hints for mm_malloc_flags, or'ed together */
+#define MM_ZERO       0x01  /* Payload must be zeroed, as with calloc */
+#define MM_LONG_LIVED 0x02  /* Block will outlive most of its neighbours */
+#define MM_GROW       0x04  /* Block is likely to be grown by realloc */
+#define MM_ALIGN_LINE 0x08  /* Payload must start on a cache line */
+#define MM_NO_SPLIT   0x10  /* A close fit may be handed over whole */
+
+/* malloc, with hints that select specialized placement paths */
+extern void *mm_malloc_flags(size_t size, int flags);
+
 extern bool mm_init(void);
 
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/* Optional allocation policies, each taking effect at the next mm_init */
+
+/* Keep free-block sizes in per-class side tables instead of the heap */
+extern void mm_set_side_table(bool enable);
+
+/* Cache freed blocks of repeated exact sizes for O(1) reuse */
+extern void mm_set_exact_cache(bool enable);
+/* Lookups and hits since mm_init; returns whether the cache is still on */
+extern bool mm_exact_cache_stats(size_t *lookups, size_t *hits);
+
+/* Stagger the cache-set offsets at which runs of small blocks start */
+extern void mm_set_coloring(bool enable);
+/* Start blocks of 2 MB or more on huge-page boundaries */
+extern void mm_set_huge_align(bool enable);
+/* Move large blocks that realloc relocates by remapping their pages */
+extern void mm_set_remap(bool enable);
+/* Bytes remapped since mm_init */
+extern size_t mm_remap_stats(void);
+
+/* Predict block lifetimes and place short-lived blocks in a nursery */
+extern void mm_set_lifetime(bool enable);
+/* Blocks allocated since mm_init, and how many went to the nursery */
+extern void mm_lifetime_stats(size_t *allocs, size_t *nursery);
+
+/* Switch to compact allocation once the heap would grow past bytes */
+extern void mm_set_soft_limit(size_t bytes);
+/* Whether the heap has switched to compact allocation */
+extern bool mm_compact_mode(void);
+
+/* Hand the pages of large, long-idle free blocks back to the system */
+extern void mm_set_purging(bool enable);
+/* Bytes purged since mm_init */
+extern size_t mm_purge_stats(void);
+
+/* Run coalescing, purging and trimming on a background thread */
+extern void mm_set_background(bool enable);
+/* Stop the background thread; call before the heap is reset or unmapped */
+extern void mm_stop_background(void);
+
+/* Serve the smallest blocks from lock-free slabs */
+extern void mm_set_slab(bool enable);
+/* Slab pages carved since mm_init */
+extern size_t mm_slab_stats(void);
+/* Per-thread slabs, with a remote-free stack for other threads' frees.
+   An exited thread's slabs pass to the next new thread; objects freed to
+   a live thread wait on its stack until that thread mallocs again. */
+extern void mm_set_owned_heaps(bool enable);
+/* Slab owners, idle ones included, and their objects freed by others */
+extern size_t mm_owned_stats(size_t *remote_frees);
+
+/* Guard the heap with a lock per size class instead of one lock */
+extern void mm_set_fine_locks(bool enable);
+/* Whether per-class locks guard the heap; other policies turn them off */
+extern bool mm_fine_locks(void);
+
+/* Keep a header at the start of the heap, from which a later process
+   mapping the same memory can take the heap over */
+extern void mm_set_persistent(bool enable);
+/* Record the heap in its header and write it back to memlib's file;
+   false if the heap isn't persistent or couldn't be written */
+extern bool mm_checkpoint(void);
+/* Take over the heap left by the last checkpoint, in place of mm_init;
+   false if there isn't one to take over */
+extern bool mm_reopen(void);
@@ -0,0 +1,807 @@
+/*
+ * mmcapture.c - Capture the allocator calls of an unmodified program as
+ *               a trace file that mdriver can replay
+ *
+ * Built as libmmcapture.so, and loaded ahead of libc with
+ *
+ *     LD_PRELOAD=./libmmcapture.so program args...
+ *
+ * it interposes malloc, free, realloc, calloc and the aligned variants,
+ * passes each call on to libc, and logs it.  Each thread logs into a
+ * buffer of its own, with no locks: one atomic counter orders the calls
+ * of all threads, and a full buffer is written to a raw log at an offset
+ * reserved by another.  As the process exits, the sorted runs of the raw
+ * log are merged, the pointers are turned into ids, and the trace is
+ * written to MMCAPTURE_PREFIX.<pid>.rep (default prefix "mmcapture"), or
+ * to .bin in the binary format of trace.h if MMCAPTURE_FORMAT is "bin".
+ *
+ * Each request in the trace carries the thread that made it, numbered by
+ * its buffer, so that threads that run one after another share a number
+ * and the count stays at the most threads running at once.
+ *
+ * Calls that overlap in time, on different threads, are ordered by when
+ * they took a number: a free before it frees, an allocation after it
+ * allocates.  A realloc that moves its block can still lose the race for
+ * the old address to another thread's malloc, and calls from before the
+ * capture started can free blocks it never saw; the trace is patched up
+ * so that it stays valid, and the patches are counted on stderr.  Blocks
+ * of 0 bytes, which mm_malloc doesn't hand out, are traced as 1 byte.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "trace.h"
+
+#define LOG_RECORDS 8192            /* Records in each thread's buffer */
+#define BOOT_BYTES 4096             /* Arena for calls made by dlsym */
+
+/* One allocator call, as logged */
+typedef struct {
+    uint64_t stamp;                 /* order among all calls << 2 | type */
+    uint64_t ptr;                   /* block freed or reallocated */
+    uint64_t result;                /* block allocated */
+    uint64_t size;                  /* bytes asked for */
+} record_t;
+
+/* A thread's records, in order, written to the raw log as they are */
+typedef struct {
+    uint64_t count;                 /* number of records */
+    uint64_t thread;                /* number of the buffer, from 0 */
+    uint64_t unused[2];             /* keeps the records 32-byte aligned */
+    record_t records[LOG_RECORDS];
+} run_t;
+
+/* A thread's buffer, kept on a list of all of them for reuse */
+typedef struct thread_log {
+    struct thread_log *next;
+    volatile int idle;              /* no thread owns it */
+    run_t run;
+} thread_log_t;
+
+/* A live block of the trace being written */
+typedef struct {
+    uint64_t ptr;                   /* 0 if the entry is empty */
+    int64_t id;
+    uint64_t size;
+} block_t;
+
+/* The live blocks, by address, with linear probing */
+typedef struct {
+    block_t *blocks;
+    size_t mask;                    /* number of entries - 1 */
+    size_t used;
+} block_map_t;
+
+/* The libc allocator */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+static char boot_arena[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+static bool resolving;
+
+static volatile bool capturing;     /* Log calls from here on */
+static char raw_name[4096];         /* Raw log of this process */
+static int raw_fd = -1;
+static int raw_state;               /* 0 until the raw log is opened, 2 after */
+static uint64_t raw_end;            /* Bytes reserved in the raw log */
+static uint64_t next_stamp;         /* Next call's place in the order */
+static thread_log_t *logs;          /* All threads' buffers */
+static uint64_t num_logs;           /* Buffers made, which numbers the next */
+static pthread_key_t log_key;       /* Flushes a thread's buffer as it exits */
+
+static __thread thread_log_t *my_log __attribute__((tls_model("initial-exec")));
+static __thread bool in_capture __attribute__((tls_model("initial-exec")));
+
+static void resolve(void);
+static void start_capture(void);
+static void finish_capture(void);
+static thread_log_t *claim_log(void);
+static void release_log(void *arg);
+static void flush_log(thread_log_t *log);
+static bool open_raw(void);
+static uint64_t take_stamp(void);
+static void log_call(uint64_t stamp, int type, void *ptr, void *result,
+                     size_t size);
+static bool write_trace(const char *name, bool binary);
+
+/*
+ * resolve - look up libc's allocator. dlsym may allocate on the way, out
+ *   of the boot arena.
+ */
+static void resolve(void)
+{
+    resolving = true;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    resolving = false;
+    if (real_malloc == NULL || real_free == NULL || real_realloc == NULL
+        || real_calloc == NULL) {
+        fprintf(stderr, "mmcapture: can't find libc's allocator\n");
+        _exit(1);
+    }
+}
+
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t) 15;
+    if (boot_used + size > BOOT_BYTES)
+        return NULL;
+    p = boot_arena + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static bool is_boot(void *ptr)
+{
+    return (char *) ptr >= boot_arena && (char *) ptr < boot_arena + BOOT_BYTES;
+}
+
+/*
+ * Whether to pass a call straight on to libc: while the capture is off,
+ * and for calls made by the capture itself
+ */
+static bool pass_through(void)
+{
+    if (real_malloc == NULL && !resolving)
+        resolve();
+    return !capturing || in_capture;
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (resolving)
+        return boot_alloc(size);
+    if (pass_through())
+        return real_malloc(size);
+    in_capture = true;
+    p = real_malloc(size);
+    log_call(take_stamp(), ALLOC, NULL, p, size);
+    in_capture = false;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (resolving)
+        return boot_alloc(nmemb * size);  /* zeroed, as never used before */
+    if (pass_through())
+        return real_calloc(nmemb, size);
+    in_capture = true;
+    p = real_calloc(nmemb, size);
+    log_call(take_stamp(), ALLOC, NULL, p, nmemb * size);
+    in_capture = false;
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint64_t stamp;
+
+    if (is_boot(ptr))
+        return;
+    if (pass_through()) {
+        real_free(ptr);
+        return;
+    }
+    in_capture = true;
+    /* Take a number before the block can go to another thread */
+    stamp = take_stamp();
+    real_free(ptr);
+    log_call(stamp, FREE, ptr, NULL, 0);
+    in_capture = false;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (is_boot(ptr)) {
+        p = malloc(size);
+        if (p != NULL)
+            memcpy(p, ptr, size < BOOT_BYTES ? size : BOOT_BYTES);
+        return p;
+    }
+    if (pass_through())
+        return real_realloc(ptr, size);
+    in_capture = true;
+    p = real_realloc(ptr, size);
+    log_call(take_stamp(), REALLOC, ptr, p, size);
+    in_capture = false;
+    return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int err;
+
+    if (pass_through())
+        return real_posix_memalign(memptr, alignment, size);
+    in_capture = true;
+    err = real_posix_memalign(memptr, alignment, size);
+    /* The trace can't say how a block was aligned, only how large */
+    if (err == 0)
+        log_call(take_stamp(), ALLOC, NULL, *memptr, size);
+    in_capture = false;
+    return err;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (pass_through())
+        return real_aligned_alloc(alignment, size);
+    in_capture = true;
+    p = real_aligned_alloc(alignment, size);
+    log_call(take_stamp(), ALLOC, NULL, p, size);
+    in_capture = false;
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (pass_through())
+        return real_memalign(alignment, size);
+    in_capture = true;
+    p = real_memalign(alignment, size);
+    log_call(take_stamp(), ALLOC, NULL, p, size);
+    in_capture = false;
+    return p;
+}
+
+/*
+ * take_stamp - the next place in the order of all threads' calls
+ */
+static uint64_t take_stamp(void)
+{
+    return __atomic_fetch_add(&next_stamp, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * log_call - append a call to the calling thread's buffer, writing the
+ *   buffer out to the raw log once it's full
+ */
+static void log_call(uint64_t stamp, int type, void *ptr, void *result,
+                     size_t size)
+{
+    thread_log_t *log = my_log != NULL ? my_log : claim_log();
+    record_t *r = &log->run.records[log->run.count];
+
+    r->stamp = stamp << 2 | type;
+    r->ptr = (uintptr_t) ptr;
+    r->result = (uintptr_t) result;
+    r->size = size;
+    if (++log->run.count == LOG_RECORDS)
+        flush_log(log);
+}
+
+/*
+ * claim_log - give the calling thread a buffer: one an exited thread
+ *   left, or else a new one pushed on the list
+ */
+static thread_log_t *claim_log(void)
+{
+    thread_log_t *log;
+
+    for (log = __atomic_load_n(&logs, __ATOMIC_ACQUIRE); log != NULL;
+         log = log->next)
+        if (log->idle && __sync_bool_compare_and_swap(&log->idle, 1, 0))
+            break;
+    if (log == NULL) {
+        log = mmap(NULL, sizeof(thread_log_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (log == MAP_FAILED) {
+            fprintf(stderr, "mmcapture: out of memory for buffers\n");
+            _exit(1);
+        }
+        log->run.thread = __atomic_fetch_add(&num_logs, 1, __ATOMIC_RELAXED);
+        log->next = __atomic_load_n(&logs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&logs, &log->next, log, false,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+    my_log = log;
+    pthread_setspecific(log_key, log);
+    return log;
+}
+
+/*
+ * release_log - as a thread exits, write out its buffer and leave it to
+ *   the next thread
+ */
+static void release_log(void *arg)
+{
+    thread_log_t *log = arg;
+
+    flush_log(log);
+    my_log = NULL;
+    __atomic_store_n(&log->idle, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * flush_log - write the records in log to the raw log as one run
+ */
+static void flush_log(thread_log_t *log)
+{
+    size_t bytes = sizeof(uint64_t) * 4 + log->run.count * sizeof(record_t);
+    uint64_t offset;
+    ssize_t n;
+    size_t done = 0;
+
+    if (log->run.count == 0)
+        return;
+    if (__atomic_load_n(&raw_state, __ATOMIC_ACQUIRE) != 2 && !open_raw()) {
+        log->run.count = 0;
+        return;
+    }
+    offset = __atomic_fetch_add(&raw_end, bytes, __ATOMIC_RELAXED);
+    while (done < bytes) {
+        n = pwrite(raw_fd, (char *) &log->run + done, bytes - done,
+                   offset + done);
+        if (n <= 0) {
+            fprintf(stderr, "mmcapture: can't write %s\n", raw_name);
+            capturing = false;
+            break;
+        }
+        done += n;
+    }
+    log->run.count = 0;
+}
+
+/*
+ * open_raw - create the raw log, on the first flush, so that a child
+ *   that execs straight after fork leaves none behind. Threads that
+ *   flush meanwhile wait for the first to open it.
+ */
+static bool open_raw(void)
+{
+    int state = 0;
+
+    if (__atomic_compare_exchange_n(&raw_state, &state, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        raw_fd = open(raw_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (raw_fd < 0) {
+            fprintf(stderr, "mmcapture: can't create %s\n", raw_name);
+            capturing = false;
+        }
+        __atomic_store_n(&raw_state, 2, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&raw_state, __ATOMIC_ACQUIRE) != 2)
+            sched_yield();
+    }
+    return raw_fd >= 0;
+}
+
+/*
+ * start_capture - start logging, to a raw log named for this process
+ */
+static void start_capture(void)
+{
+    const char *prefix = getenv("MMCAPTURE_PREFIX");
+    thread_log_t *log;
+
+    in_capture = true;
+    if (prefix == NULL)
+        prefix = "mmcapture";
+    snprintf(raw_name, sizeof(raw_name), "%s.%d.raw", prefix, (int) getpid());
+    raw_fd = -1;
+    raw_state = 0;
+    raw_end = 0;
+    /* Buffers inherited across fork hold the parent's calls */
+    for (log = logs; log != NULL; log = log->next) {
+        log->run.count = 0;
+        if (log != my_log)
+            log->idle = 1;
+    }
+    capturing = true;
+    in_capture = false;
+}
+
+static void capture_child(void)
+{
+    if (raw_fd >= 0)
+        close(raw_fd);
+    raw_fd = -1;
+    capturing = false;
+    start_capture();
+}
+
+__attribute__((constructor))
+static void capture_init(void)
+{
+    if (real_malloc == NULL)
+        resolve();
+    pthread_key_create(&log_key, release_log);
+    pthread_atfork(NULL, NULL, capture_child);
+    start_capture();
+}
+
+__attribute__((destructor))
+static void capture_fini(void)
+{
+    finish_capture();
+}
+
+/*
+ * finish_capture - stop logging, write out every buffer, and turn the
+ *   raw log into the trace. Threads still running lose their last calls.
+ */
+static void finish_capture(void)
+{
+    const char *format = getenv("MMCAPTURE_FORMAT");
+    const char *prefix = getenv("MMCAPTURE_PREFIX");
+    bool binary = format != NULL && strcmp(format, "bin") == 0;
+    char name[4096];
+    thread_log_t *log;
+
+    if (!capturing)
+        return;
+    capturing = false;
+    in_capture = true;
+    for (log = logs; log != NULL; log = log->next)
+        flush_log(log);
+    if (raw_fd < 0) { /* no calls at all */
+        in_capture = false;
+        return;
+    }
+    snprintf(name, sizeof(name), "%s.%d.%s",
+             prefix != NULL ? prefix : "mmcapture", (int) getpid(),
+             binary ? "bin" : "rep");
+    if (write_trace(name, binary))
+        unlink(raw_name);
+    close(raw_fd);
+    raw_fd = -1;
+    in_capture = false;
+}
+
+/**********************************************
+ * The following routines turn the raw log into a trace
+ *********************************************/
+
+static size_t block_home(const block_map_t *map, uint64_t ptr)
+{
+    return (ptr * 0x9e3779b97f4a7c15UL >> 20) & map->mask;
+}
+
+/*
+ * block_find - the entry of the live block at ptr, or NULL
+ */
+static block_t *block_find(block_map_t *map, uint64_t ptr)
+{
+    size_t i;
+
+    for (i = block_home(map, ptr); map->blocks[i].ptr != 0;
+         i = (i + 1) & map->mask)
+        if (map->blocks[i].ptr == ptr)
+            return &map->blocks[i];
+    return NULL;
+}
+
+/*
+ * block_insert - add a live block at ptr, which has none, doubling the
+ *   map once it's half full
+ */
+static void block_insert(block_map_t *map, uint64_t ptr, int64_t id,
+                         uint64_t size)
+{
+    block_t *old = map->blocks;
+    size_t i, old_size = map->mask + 1;
+
+    if (2 * (map->used + 1) > old_size) {
+        map->blocks = calloc(2 * old_size, sizeof(block_t));
+        if (map->blocks == NULL) {
+            fprintf(stderr, "mmcapture: out of memory for the trace\n");
+            _exit(1);
+        }
+        map->mask = 2 * old_size - 1;
+        map->used = 0;
+        for (i = 0; i < old_size; i++)
+            if (old[i].ptr != 0)
+                block_insert(map, old[i].ptr, old[i].id, old[i].size);
+        free(old);
+    }
+    for (i = block_home(map, ptr); map->blocks[i].ptr != 0;
+         i = (i + 1) & map->mask)
+        ;
+    map->blocks[i].ptr = ptr;
+    map->blocks[i].id = id;
+    map->blocks[i].size = size;
+    map->used++;
+}
+
+/*
+ * block_remove - forget the live block whose entry is b, moving back
+ *   any entries after it that would no longer be found past the hole
+ */
+static void block_remove(block_map_t *map, block_t *b)
+{
+    size_t i = b - map->blocks, j, home;
+
+    for (j = (i + 1) & map->mask; map->blocks[j].ptr != 0;
+         j = (j + 1) & map->mask) {
+        home = block_home(map, map->blocks[j].ptr);
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->blocks[i] = map->blocks[j];
+            i = j;
+        }
+    }
+    map->blocks[i].ptr = 0;
+    map->used--;
+}
+
+/* Where the merge is in each run, kept as a heap on the next stamp */
+typedef struct {
+    const record_t *next;
+    const record_t *end;
+    int thread;                     /* thread of the run's records */
+} cursor_t;
+
+static void sift_down(cursor_t *heap, size_t n, size_t i)
+{
+    cursor_t c = heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && heap[child + 1].next->stamp < heap[child].next->stamp)
+            child++;
+        if (c.next->stamp <= heap[child].next->stamp)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = c;
+}
+
+/* The trace being written, and what's known of it so far */
+typedef struct {
+    FILE *file;
+    bool binary;
+    uint64_t num_ops;
+    int64_t num_ids;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} writer_t;
+
+static void emit(writer_t *w, int thread, int type, int64_t id,
+                 uint64_t size)
+{
+    traceop_t op;
+
+    w->num_ops++;
+    if (w->binary) {
+        op.type = type;
+        op.thread = thread;
+        op.index = id;
+        op.size = size;
+        fwrite(&op, sizeof(op), 1, w->file);
+        return;
+    }
+    if (thread > 0)
+        fprintf(w->file, "%d: ", thread);
+    if (type == FREE) {
+        fprintf(w->file, "f %lld\n", (long long) id);
+    } else {
+        fprintf(w->file, "%c %lld %llu\n", type == ALLOC ? 'a' : 'r',
+                (long long) id, (unsigned long long) size);
+    }
+}
+
+/*
+ * emit_header - write the header of the trace, at the start of the file,
+ *   in a fixed width so the counts can be filled in at the end
+ */
+static void emit_header(writer_t *w)
+{
+    trace_header_t header;
+
+    rewind(w->file);
+    if (w->binary) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.weight = 1;
+        header.num_ids = w->num_ids;
+        header.num_ops = w->num_ops;
+        header.data_bytes = w->peak_bytes;
+        fwrite(&header, sizeof(header), 1, w->file);
+    } else {
+        fprintf(w->file, "%20d\n%20lld\n%20llu\n%20llu\n", 1,
+                (long long) w->num_ids, (unsigned long long) w->num_ops,
+                (unsigned long long) w->peak_bytes);
+    }
+}
+
+/*
+ * end_block - free the live block b, in the trace and the map, on thread
+ */
+static void end_block(writer_t *w, int thread, block_map_t *map, block_t *b)
+{
+    emit(w, thread, FREE, b->id, 0);
+    w->live_bytes -= b->size;
+    block_remove(map, b);
+}
+
+/*
+ * new_block - allocate a block at ptr, in the trace and the map, on
+ *   thread. A block still live there was freed by a call that took its
+ *   number late.
+ */
+static void new_block(writer_t *w, int thread, block_map_t *map,
+                      uint64_t ptr, uint64_t size, uint64_t *patched)
+{
+    block_t *b = block_find(map, ptr);
+
+    if (b != NULL) {
+        end_block(w, thread, map, b);
+        (*patched)++;
+    }
+    emit(w, thread, ALLOC, w->num_ids, size);
+    block_insert(map, ptr, w->num_ids++, size);
+    w->live_bytes += size;
+}
+
+/*
+ * write_trace - merge the runs of the raw log in order, and write them
+ *   to the trace name with pointers turned into ids. Returns false,
+ *   leaving the raw log, if the trace couldn't be written.
+ */
+static bool write_trace(const char *name, bool binary)
+{
+    writer_t w = { NULL, binary, 0, 0, 0, 0 };
+    block_map_t map;
+    cursor_t *heap = NULL;
+    size_t num_runs = 0, max_runs = 0;
+    uint64_t offset, size, unmatched = 0, patched = 0;
+    const run_t *run;
+    const record_t *r;
+    block_t *b;
+    char *raw = NULL;
+    int thread;
+
+    if (raw_end > 0) {
+        raw = mmap(NULL, raw_end, PROT_READ, MAP_PRIVATE, raw_fd, 0);
+        if (raw == MAP_FAILED) {
+            fprintf(stderr, "mmcapture: can't map %s\n", raw_name);
+            return false;
+        }
+    }
+    for (offset = 0; offset < raw_end;
+         offset += sizeof(uint64_t) * 4 + run->count * sizeof(record_t)) {
+        run = (const run_t *) (raw + offset);
+        if (num_runs == max_runs) {
+            max_runs = max_runs ? 2 * max_runs : 64;
+            heap = realloc(heap, max_runs * sizeof(cursor_t));
+            if (heap == NULL) {
+                fprintf(stderr, "mmcapture: out of memory for the trace\n");
+                _exit(1);
+            }
+        }
+        heap[num_runs].next = run->records;
+        heap[num_runs].end = run->records + run->count;
+        heap[num_runs].thread = run->thread < TRACE_MAX_THREAD
+                                ? run->thread : TRACE_MAX_THREAD;
+        num_runs++;
+    }
+    for (offset = num_runs / 2; offset-- > 0; )
+        sift_down(heap, num_runs, offset);
+
+    if ((w.file = fopen(name, "w")) == NULL) {
+        fprintf(stderr, "mmcapture: can't create %s\n", name);
+        return false;
+    }
+    emit_header(&w);
+    map.mask = 1023;
+    map.used = 0;
+    map.blocks = calloc(map.mask + 1, sizeof(block_t));
+
+    while (num_runs > 0) {
+        thread = heap[0].thread;
+        r = heap[0].next++;
+        if (heap[0].next == heap[0].end)
+            heap[0] = heap[--num_runs];
+        sift_down(heap, num_runs, 0);
+
+        /* A block of 0 bytes is a null pointer to mm_malloc */
+        size = r->size > 0 ? r->size : 1;
+        switch (r->stamp & 3) {
+        case ALLOC:
+            if (r->result != 0)
+                new_block(&w, thread, &map, r->result, size, &patched);
+            break;
+        case FREE:
+            if (r->ptr == 0)
+                emit(&w, thread, FREE, -1, 0);
+            else if ((b = block_find(&map, r->ptr)) != NULL)
+                end_block(&w, thread, &map, b);
+            else
+                unmatched++;
+            break;
+        case REALLOC:
+            b = r->ptr != 0 ? block_find(&map, r->ptr) : NULL;
+            if (r->result == 0) {
+                /* realloc(ptr, 0) frees; otherwise it failed */
+                if (b != NULL && r->size == 0)
+                    end_block(&w, thread, &map, b);
+                break;
+            }
+            if (b == NULL) {
+                unmatched += r->ptr != 0;
+                new_block(&w, thread, &map, r->result, size, &patched);
+                break;
+            }
+            emit(&w, thread, REALLOC, b->id, size);
+            w.live_bytes += size - b->size;
+            if (r->result == r->ptr) {
+                b->size = size;
+            } else {
+                int64_t id = b->id;
+                block_remove(&map, b);
+                if ((b = block_find(&map, r->result)) != NULL) {
+                    end_block(&w, thread, &map, b);
+                    patched++;
+                }
+                block_insert(&map, r->result, id, size);
+            }
+            break;
+        }
+        if (w.live_bytes > w.peak_bytes)
+            w.peak_bytes = w.live_bytes;
+    }
+
+    emit_header(&w);
+    if (fclose(w.file) != 0) {
+        fprintf(stderr, "mmcapture: can't write %s\n", name);
+        return false;
+    }
+    if (raw != NULL)
+        munmap(raw, raw_end);
+    free(heap);
+    free(map.blocks);
+    if (unmatched > 0 || patched > 0)
+        fprintf(stderr, "mmcapture: %s: %llu calls on blocks from before the "
+                "capture left out, %llu reordered calls patched\n", name,
+                (unsigned long long) unmatched, (unsigned long long) patched);
+    return true;
+}
@@ -0,0 +1,182 @@
+/*
+ * mtbench.c - Multi-threaded small-object benchmark for mm.c
+ *
+ * Runs several threads that each allocate, fill, check and free a
+ * window of small blocks, with the lock-free slabs, with per-class
+ * locks, and with every call under one mutex, and reports the
+ * throughput of each. With -c each thread uses a size class of its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAX_THREADS 64
+#define WINDOW 256              /* Blocks each thread keeps live */
+
+static int num_threads = 4;
+static long num_ops = 1000000;  /* malloc/free pairs per thread */
+static bool spread;             /* Give each thread its own size class */
+static bool use_lock;           /* Serialize calls through big_lock */
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool failed;
+
+static void *bench_malloc(size_t size)
+{
+    void *p;
+
+    if (use_lock)
+        pthread_mutex_lock(&big_lock);
+    p = mm_malloc(size);
+    if (use_lock)
+        pthread_mutex_unlock(&big_lock);
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (use_lock)
+        pthread_mutex_lock(&big_lock);
+    mm_free(p);
+    if (use_lock)
+        pthread_mutex_unlock(&big_lock);
+}
+
+/*
+ * worker - replaces a pseudo-random slot of its window on every step,
+ *          checking that the old block still holds what it wrote
+ */
+static void *worker(void *arg)
+{
+    unsigned char *window[WINDOW] = { NULL };
+    size_t sizes[WINDOW] = { 0 };
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    unsigned char tag = (unsigned char)(uintptr_t)arg;
+    long i;
+    int k;
+
+    for (i = 0; i < num_ops && !failed; i++) {
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % WINDOW;
+        if (window[k] != NULL) {
+            if (window[k][0] != tag || window[k][sizes[k] - 1] != tag) {
+                fprintf(stderr, "thread %u: block %p was overwritten\n",
+                        (unsigned int)tag, (void *)window[k]);
+                failed = true;
+            }
+            bench_free(window[k]);
+        }
+        if (spread)     /* 32 << t to 64 << t bytes, in class t + 1 */
+            sizes[k] = ((size_t)32 << (tag % 8)) - 8
+                       + ((seed >> 16) % ((size_t)2 << (tag % 8))) * 16;
+        else
+            sizes[k] = 8 + ((seed >> 16) % 49);   /* 8 to 56 bytes */
+        window[k] = bench_malloc(sizes[k]);
+        if (window[k] == NULL) {
+            fprintf(stderr, "thread %u: out of memory\n", (unsigned int)tag);
+            failed = true;
+            break;
+        }
+        memset(window[k], tag, sizes[k]);
+    }
+    for (k = 0; k < WINDOW; k++)
+        if (window[k] != NULL)
+            bench_free(window[k]);
+    return NULL;
+}
+
+/*
+ * run - times one configuration and returns its Kops/sec
+ */
+static double run(bool slab, bool fine)
+{
+    pthread_t threads[MAX_THREADS];
+    struct timespec start, end;
+    double secs;
+    int t;
+
+    mem_init(false);
+    mm_set_slab(slab);
+    mm_set_fine_locks(fine);
+    use_lock = !slab && !fine;
+    if (!mm_init() || mm_fine_locks() != fine) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < num_threads; t++)
+        pthread_create(&threads[t], NULL, worker, (void *)(uintptr_t)(t + 1));
+    for (t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!mm_checkheap(__LINE__))
+        failed = true;
+    mm_stop_background();
+    mem_deinit();
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return 2.0 * num_ops * num_threads / secs / 1000.0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-hc] [-t <threads>] [-n <ops>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c         Give each thread its own size class.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <ops>   Allocations per thread (default %ld).\n",
+            num_ops);
+    fprintf(stderr, "\t-t <n>     Number of threads (default %d).\n",
+            num_threads);
+}
+
+int main(int argc, char **argv)
+{
+    double slab_kops, fine_kops, lock_kops;
+    int c;
+
+    while ((c = getopt(argc, argv, "chn:t:")) != EOF) {
+        switch (c) {
+        case 'c':
+            spread = true;
+            break;
+        case 'n':
+            num_ops = atol(optarg);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                fprintf(stderr, "Thread count must be 1 to %d\n",
+                        MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    slab_kops = run(true, false);
+    fine_kops = run(false, true);
+    lock_kops = run(false, false);
+    if (failed) {
+        printf("ERROR: mtbench found a broken heap\n");
+        exit(1);
+    }
+    printf("%d threads, %ld ops each\n", num_threads, 2 * num_ops);
+    printf("  lock-free slabs:  %10.0f Kops/sec\n", slab_kops);
+    printf("  per-class locks:  %10.0f Kops/sec\n", fine_kops);
+    printf("  one mutex:        %10.0f Kops/sec\n", lock_kops);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the binary trace format
+ *
+ * The binary trace, described in trace.h, holds the same header fields
+ * and requests, and mdriver maps it instead of parsing it.  The text is
+ * checked as it's read: every id must be below the header's id count,
+ * and the number of requests must match.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024
+#define OPS_PER_WRITE 4096      /* Requests buffered between writes */
+
+static void fail(const char *name, long line, const char *msg)
+{
+    fprintf(stderr, "%s:%ld: %s\n", name, line, msg);
+    exit(1);
+}
+
+/*
+ * read_number - parse the next number of line at *pos, advancing *pos
+ *               past it, and return false if there's none
+ */
+static bool read_number(char **pos, long long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtoll(*pos, &end, 10);
+    if (end == *pos || errno != 0)
+        return false;
+    *pos = end;
+    return true;
+}
+
+/*
+ * convert - write the trace in the text file in as a binary trace to out
+ */
+static void convert(const char *name, FILE *in, FILE *out)
+{
+    trace_header_t header;
+    traceop_t ops[OPS_PER_WRITE];
+    char line[MAXLINE];
+    char *pos;
+    long long fields[4], index, size, thread;
+    long lineno = 0;
+    uint64_t count = 0;
+    int n = 0, i;
+
+    for (i = 0; i < 4; i++) {
+        lineno++;
+        pos = line;
+        if (fgets(line, sizeof(line), in) == NULL
+            || !read_number(&pos, &fields[i]) || fields[i] < 0)
+            fail(name, lineno, "bad header line");
+    }
+    if (fields[0] > 3)
+        fail(name, 1, "weight can only be in {0, 1, 2, 3}");
+    if (fields[1] > INT32_MAX)
+        fail(name, 2, "too many ids");
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.weight = fields[0];
+    header.num_ids = fields[1];
+    header.num_ops = fields[2];
+    header.data_bytes = fields[3];
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+        fail(name, lineno, "write failed");
+
+    while (count < header.num_ops && fgets(line, sizeof(line), in) != NULL) {
+        lineno++;
+        pos = line + strspn(line, " \t");
+        if (*pos == '\n' || *pos == '\0')
+            continue;
+        thread = 0;
+        if (*pos >= '0' && *pos <= '9') { /* "<thread>:" before the request */
+            if (!read_number(&pos, &thread) || *pos++ != ':'
+                || thread > TRACE_MAX_THREAD)
+                fail(name, lineno, "bad thread id");
+            pos += strspn(pos, " \t");
+        }
+        switch (*pos++) {
+        case 'a':
+            ops[n].type = ALLOC;
+            break;
+        case 'r':
+            ops[n].type = REALLOC;
+            break;
+        case 'f':
+            ops[n].type = FREE;
+            break;
+        default:
+            fail(name, lineno, "bogus request type");
+        }
+        if (!read_number(&pos, &index)
+            || index < -1 || index >= (long long) header.num_ids
+            || (index == -1 && ops[n].type != FREE))
+            fail(name, lineno, "bad id");
+        size = 0;
+        if (ops[n].type != FREE && (!read_number(&pos, &size) || size < 0))
+            fail(name, lineno, "bad size");
+        ops[n].thread = thread;
+        ops[n].index = index;
+        ops[n].size = size;
+        count++;
+        if (++n == OPS_PER_WRITE) {
+            if (fwrite(ops, sizeof(traceop_t), n, out) != (size_t) n)
+                fail(name, lineno, "write failed");
+            n = 0;
+        }
+    }
+    if (n > 0 && fwrite(ops, sizeof(traceop_t), n, out) != (size_t) n)
+        fail(name, lineno, "write failed");
+    if (count != header.num_ops)
+        fail(name, lineno, "fewer requests than the header says");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: rep2bin <trace.rep> <trace.bin>\n");
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if ((out = fopen(argv[2], "wb")) == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+    convert(argv[1], in, out);
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    return 0;
+}
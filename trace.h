@@ -0,0 +1,38 @@
+/*
+ * trace.h - Trace operations, and the binary trace format
+ *
+ * A binary trace holds the same requests as a text .rep file, laid out
+ * so that mdriver can map the file and use its operations where they
+ * lie, with no parsing: a trace_header_t, then num_ops traceop_t
+ * records.  All fields are little-endian.  rep2bin converts a .rep file.
+ *
+ * Version 2 added the thread of each request, in what were the high bits
+ * of its type, so a version 1 trace reads as one whose requests are all
+ * made by thread 0.
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC "mmtrace1"      /* First 8 bytes of a binary trace */
+#define TRACE_VERSION 2
+#define TRACE_MAX_THREAD UINT16_MAX /* Highest thread id a request can have */
+
+/* Types of request */
+enum { ALLOC, FREE, REALLOC };
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint16_t type;                  /* ALLOC, FREE or REALLOC */
+    uint16_t thread;                /* thread that made the request */
+    int32_t index;                  /* block id; -1 frees the null pointer */
+    uint64_t size;                  /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Start of a binary trace, followed by its operations */
+typedef struct {
+    char magic[8];                  /* TRACE_MAGIC, not null-terminated */
+    uint32_t version;               /* TRACE_VERSION */
+    uint32_t weight;                /* weight for this trace, 0 to 3 */
+    uint64_t num_ids;               /* number of request ids */
+    uint64_t num_ops;               /* number of requests (operations) */
+    uint64_t data_bytes;            /* peak data bytes allocated */
+} trace_header_t;
@@ -0,0 +1,694 @@
+/*
+ * tracegen.c - Generate synthetic .rep traces from a workload model
+ *
+ * A model gives the distribution of block sizes, the shape of the
+ * distribution of block lifetimes, the share of blocks grown by chains
+ * of reallocs, how many blocks are live at once and how many requests
+ * there are.  Lifetimes are scaled so that the live set settles at its
+ * target: each block takes 2 + (chain steps) requests, so a block must
+ * live that many requests times the live target, on average.
+ *
+ * With -f the model is fitted to an existing trace, text or binary, and
+ * -x scales its requests and live set, to stress an allocator with 10x
+ * or 100x the load the trace came from.  Options given as well override
+ * the fitted values.  The same options and seed give the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024
+#define MAX_SET 4096                /* Sizes in a fixed set */
+
+/* Distributions of block sizes */
+typedef enum { SIZE_POWER, SIZE_BIMODAL, SIZE_SET } size_kind_t;
+
+/* Shapes of the distribution of block lifetimes */
+typedef enum { LIFE_EXP, LIFE_POWER, LIFE_UNIFORM, LIFE_FITTED } life_kind_t;
+
+typedef struct {
+    size_kind_t size_kind;
+    double size_a, size_b, size_c;  /* power: min, max, alpha;
+                                       bimodal: small, large, share large */
+    uint64_t *set_sizes;            /* set: sizes and their weights */
+    double *set_weights;            /* cumulative, ending at 1 */
+    int set_count;
+
+    life_kind_t life_kind;
+    double life_alpha;              /* power: tail exponent, above 1 */
+    uint64_t *fitted_lives;         /* fitted: lifetimes seen, in requests */
+    size_t num_fitted;
+    double fitted_mean;
+
+    double chain_share;             /* share of blocks grown by reallocs */
+    int chain_steps;                /* reallocs in each chain */
+    double chain_factor;            /* growth of each realloc */
+
+    uint64_t live;                  /* target number of live blocks */
+    uint64_t num_ops;               /* requests to generate */
+    int weight;                     /* weight in the trace header */
+} model_t;
+
+/* A live block, and the next thing that happens to it */
+typedef struct {
+    uint64_t when;                  /* request number of the next event */
+    int64_t id;
+    uint64_t size;
+    uint64_t death;                 /* request number of its free */
+    int steps_left;                 /* reallocs still to come */
+} block_t;
+
+static bool verbose;
+
+/**********************************************
+ * Random numbers, the same on every platform
+ *********************************************/
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15UL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform in (0, 1) */
+static double rng_unit(void)
+{
+    return ((rng_next() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/**********************************************
+ * Sampling the model
+ *********************************************/
+
+static uint64_t sample_size(const model_t *m)
+{
+    double u = rng_unit(), x, e;
+    int lo, hi, mid;
+
+    switch (m->size_kind) {
+    case SIZE_POWER: /* p(x) ~ x^-alpha on [min, max] */
+        if (fabs(m->size_c - 1) < 1e-9) {
+            x = m->size_a * pow(m->size_b / m->size_a, u);
+        } else {
+            e = 1 - m->size_c;
+            x = pow(pow(m->size_a, e)
+                    + u * (pow(m->size_b, e) - pow(m->size_a, e)), 1 / e);
+        }
+        break;
+    case SIZE_BIMODAL: /* within a quarter of either mode */
+        x = rng_unit() < m->size_c ? m->size_b : m->size_a;
+        x *= 0.75 + 0.5 * u;
+        break;
+    default: /* the first size whose cumulative weight reaches u */
+        lo = 0;
+        hi = m->set_count - 1;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (m->set_weights[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return m->set_sizes[lo];
+    }
+    return x < 1 ? 1 : (uint64_t) x;
+}
+
+/*
+ * sample_life - a lifetime in requests, from the model's shape, scaled
+ *   to have mean
+ */
+static uint64_t sample_life(const model_t *m, double mean)
+{
+    double u = rng_unit(), x;
+
+    switch (m->life_kind) {
+    case LIFE_EXP:
+        x = -mean * log(u);
+        break;
+    case LIFE_POWER: /* Pareto, with its minimum set by the mean */
+        x = mean * (m->life_alpha - 1) / m->life_alpha
+            * pow(u, -1 / m->life_alpha);
+        break;
+    case LIFE_UNIFORM:
+        x = 2 * mean * u;
+        break;
+    default:
+        x = m->fitted_lives[rng_next() % m->num_fitted]
+            * (mean / m->fitted_mean);
+        break;
+    }
+    return x < 1 ? 1 : x > 1e18 ? (uint64_t) 1e18 : (uint64_t) x;
+}
+
+/**********************************************
+ * Generating the trace
+ *********************************************/
+
+/* The live blocks, as a heap on the time of their next event */
+static block_t *heap;
+static size_t heap_count, heap_max;
+
+static void heap_push(const block_t *b)
+{
+    size_t i = heap_count++;
+
+    if (heap_count > heap_max) {
+        heap_max = heap_max ? 2 * heap_max : 1024;
+        if ((heap = realloc(heap, heap_max * sizeof(block_t))) == NULL) {
+            fprintf(stderr, "tracegen: out of memory\n");
+            exit(1);
+        }
+    }
+    while (i > 0 && heap[(i - 1) / 2].when > b->when) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = *b;
+}
+
+static block_t heap_pop(void)
+{
+    block_t top = heap[0], last = heap[--heap_count];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < heap_count) {
+        if (child + 1 < heap_count && heap[child + 1].when < heap[child].when)
+            child++;
+        if (last.when <= heap[child].when)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_count > 0)
+        heap[i] = last;
+    return top;
+}
+
+/*
+ * write_header - write the header of the trace, at the start of out, in
+ *   a fixed width so that the counts can be filled in at the end
+ */
+static void write_header(FILE *out, int weight, int64_t num_ids,
+                         uint64_t num_ops, uint64_t peak_bytes)
+{
+    rewind(out);
+    fprintf(out, "%20d\n%20lld\n%20llu\n%20llu\n", weight,
+            (long long) num_ids, (unsigned long long) num_ops,
+            (unsigned long long) peak_bytes);
+}
+
+/*
+ * generate - write the model's trace to out. Each request either frees
+ *   or reallocs the block whose next event is due, or allocates a new
+ *   one, whose free, and reallocs if it's a chain, are then scheduled.
+ */
+static void generate(const model_t *m, FILE *out)
+{
+    double per_block = 2 + m->chain_share * m->chain_steps;
+    double mean_life = m->live * per_block;
+    uint64_t ops = 0, size, life, live_bytes = 0, peak_bytes = 0;
+    int64_t num_ids = 0;
+    block_t b;
+
+    write_header(out, m->weight, 0, 0, 0);
+
+    /* Allocate until the blocks still live would use up the rest */
+    while (ops + heap_count < m->num_ops) {
+        if (heap_count > 0 && heap[0].when <= ops) {
+            b = heap_pop();
+            if (b.steps_left > 0) {
+                size = b.size * m->chain_factor + 0.5;
+                if (size == 0)
+                    size = 1;
+                fprintf(out, "r %lld %llu\n", (long long) b.id,
+                        (unsigned long long) size);
+                live_bytes += size - b.size;
+                b.size = size;
+                /* Space the rest of the chain out over the lifetime */
+                b.when += (b.death - b.when) / b.steps_left--;
+                heap_push(&b);
+            } else {
+                fprintf(out, "f %lld\n", (long long) b.id);
+                live_bytes -= b.size;
+            }
+        } else {
+            life = sample_life(m, mean_life);
+            b.id = num_ids++;
+            b.size = sample_size(m);
+            b.death = ops + life;
+            b.steps_left = rng_unit() < m->chain_share ? m->chain_steps : 0;
+            b.when = ops + life / (b.steps_left + 1);
+            fprintf(out, "a %lld %llu\n", (long long) b.id,
+                    (unsigned long long) b.size);
+            live_bytes += b.size;
+            heap_push(&b);
+        }
+        ops++;
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+
+    /* Then free them all, in the order they would have died */
+    while (heap_count > 0) {
+        b = heap_pop();
+        fprintf(out, "f %lld\n", (long long) b.id);
+        ops++;
+    }
+    write_header(out, m->weight, num_ids, ops, peak_bytes);
+
+    if (verbose)
+        fprintf(stderr, "tracegen: %llu requests, %lld ids, peak %llu bytes\n",
+                (unsigned long long) ops, (long long) num_ids,
+                (unsigned long long) peak_bytes);
+}
+
+/**********************************************
+ * Fitting a model to a trace
+ *********************************************/
+
+static int compare_sizes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * read_op - the next request of a text or binary trace, false at its end
+ */
+static bool read_op(FILE *in, bool binary, traceop_t *op)
+{
+    char line[MAXLINE], type, *pos;
+    long long index;
+    unsigned long long size = 0;
+
+    if (binary)
+        return fread(op, sizeof(*op), 1, in) == 1;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        /* Which thread made the request doesn't matter to the model */
+        pos = line + strspn(line, " \t");
+        op->thread = strtoul(pos, &pos, 10);
+        if (*pos == ':')
+            pos++;
+        if (sscanf(pos, " %c %lld %llu", &type, &index, &size) < 2)
+            continue;
+        op->type = type == 'a' ? ALLOC : type == 'r' ? REALLOC : FREE;
+        op->index = index;
+        op->size = size;
+        return true;
+    }
+    return false;
+}
+
+static void *must_alloc(size_t bytes)
+{
+    void *p = calloc(1, bytes > 0 ? bytes : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "tracegen: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * fit - set the model to the trace in name: its sizes as a fixed set, its
+ *   lifetimes as they are, its realloc chains, its average live set and
+ *   its number of requests
+ */
+static void fit(model_t *m, const char *name)
+{
+    FILE *in;
+    trace_header_t header;
+    long long fields[4];
+    bool binary = false;
+    traceop_t op;
+    uint64_t *sizes, *births, *cur_sizes;
+    bool *alive;
+    int *steps;
+    uint64_t i, k, num_ops, num_sizes = 0, distinct = 0;
+    uint64_t chains = 0, chain_steps = 0, growths = 0;
+    uint64_t live = 0, live_sum = 0;
+    double log_growth = 0, life_sum = 0;
+    int j;
+
+    if ((in = fopen(name, "r")) == NULL) {
+        perror(name);
+        exit(1);
+    }
+    if (fread(&header, sizeof(header), 1, in) == 1
+        && memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0) {
+        binary = true;
+        fields[0] = header.weight;
+        fields[1] = header.num_ids;
+        fields[2] = header.num_ops;
+    } else {
+        rewind(in);
+        for (j = 0; j < 4; j++)
+            if (fscanf(in, "%lld", &fields[j]) != 1 || fields[j] < 0) {
+                fprintf(stderr, "%s: bad header\n", name);
+                exit(1);
+            }
+    }
+
+    sizes = must_alloc(fields[1] * sizeof(uint64_t));
+    births = must_alloc(fields[1] * sizeof(uint64_t));
+    cur_sizes = must_alloc(fields[1] * sizeof(uint64_t));
+    alive = must_alloc(fields[1] * sizeof(bool));
+    steps = must_alloc(fields[1] * sizeof(int));
+    m->fitted_lives = must_alloc(fields[1] * sizeof(uint64_t));
+    m->num_fitted = 0;
+
+    for (i = 0; i < (uint64_t) fields[2] && read_op(in, binary, &op); i++) {
+        if (op.index >= 0 && op.index < fields[1]) {
+            switch (op.type) {
+            case ALLOC:
+                sizes[num_sizes++] = op.size;
+                births[op.index] = i;
+                cur_sizes[op.index] = op.size;
+                alive[op.index] = true;
+                live++;
+                break;
+            case REALLOC:
+                if (steps[op.index]++ == 0)
+                    chains++;
+                chain_steps++;
+                if (cur_sizes[op.index] > 0 && op.size > 0) {
+                    log_growth += log((double) op.size / cur_sizes[op.index]);
+                    growths++;
+                }
+                cur_sizes[op.index] = op.size;
+                break;
+            default:
+                if (alive[op.index]) {
+                    m->fitted_lives[m->num_fitted++] = i - births[op.index];
+                    alive[op.index] = false;
+                    live--;
+                }
+                break;
+            }
+        }
+        live_sum += live;
+    }
+    fclose(in);
+    num_ops = i;
+
+    /* Blocks never freed live to the end */
+    for (j = 0; j < fields[1]; j++)
+        if (alive[j])
+            m->fitted_lives[m->num_fitted++] = num_ops - births[j];
+    for (k = 0; k < m->num_fitted; k++)
+        life_sum += m->fitted_lives[k];
+    m->fitted_mean = m->num_fitted > 0 ? life_sum / m->num_fitted : 0;
+    m->life_kind = m->fitted_mean > 0 ? LIFE_FITTED : LIFE_EXP;
+
+    /* The sizes, each weighted by its share, or MAX_SET quantiles of them */
+    qsort(sizes, num_sizes, sizeof(uint64_t), compare_sizes);
+    for (k = 0; k < num_sizes; k++)
+        distinct += k == 0 || sizes[k] != sizes[k - 1];
+    m->size_kind = SIZE_SET;
+    m->set_count = 0;
+    m->set_sizes = must_alloc(MAX_SET * sizeof(uint64_t));
+    m->set_weights = must_alloc(MAX_SET * sizeof(double));
+    if (distinct <= MAX_SET) {
+        for (k = 0; k < num_sizes; k++) {
+            if (k + 1 < num_sizes && sizes[k + 1] == sizes[k])
+                continue;
+            m->set_sizes[m->set_count] = sizes[k] > 0 ? sizes[k] : 1;
+            m->set_weights[m->set_count++] = (double) (k + 1) / num_sizes;
+        }
+    } else {
+        for (j = 1; j <= MAX_SET; j++) {
+            k = (num_sizes * j + MAX_SET - 1) / MAX_SET - 1;
+            m->set_sizes[m->set_count] = sizes[k] > 0 ? sizes[k] : 1;
+            m->set_weights[m->set_count++] = (double) j / MAX_SET;
+        }
+    }
+    if (m->set_count == 0) {
+        m->set_sizes[0] = 1;
+        m->set_weights[0] = 1;
+        m->set_count = 1;
+    }
+
+    m->chain_share = num_sizes > 0 ? (double) chains / num_sizes : 0;
+    m->chain_steps = chains > 0 ? (chain_steps + chains / 2) / chains : 0;
+    m->chain_factor = growths > 0 ? exp(log_growth / growths) : 1;
+    m->live = num_ops > 0 ? (live_sum + num_ops / 2) / num_ops : 0;
+    m->num_ops = num_ops;
+    m->weight = fields[0];
+
+    free(sizes);
+    free(births);
+    free(cur_sizes);
+    free(alive);
+    free(steps);
+}
+
+/**********************************************
+ * Reading the options
+ *********************************************/
+
+static void usage(void)
+{
+    fprintf(stderr,
+"Usage: tracegen [-hv] [-f <trace>] [-x <scale>] [-s <seed>] [-n <ops>]\n"
+"                [-l <live>] [-d <sizes>] [-t <lifetimes>]\n"
+"                [-r <share>,<steps>,<factor>] [-w <weight>] -o <out.rep>\n"
+"Options\n"
+"\t-f <trace>  Fit the model to a .rep or binary trace\n"
+"\t-x <scale>  Scale the requests and the live set by <scale>\n"
+"\t-s <seed>   Seed for the random numbers (default 1)\n"
+"\t-n <ops>    Number of requests, give or take one (default 100000)\n"
+"\t-l <live>   Target number of live blocks (default 1000)\n"
+"\t-d <sizes>  Block sizes: power:<min>,<max>,<alpha> (default\n"
+"\t            power:8,4096,1.5), bimodal:<small>,<large>,<share large>\n"
+"\t            or set:<size>[x<weight>],...\n"
+"\t-t <lives>  Shape of the lifetimes: exp (default), power:<alpha>\n"
+"\t            or uniform; their mean follows from the live set\n"
+"\t-r <chain>  Share of blocks grown by <steps> reallocs of <factor>\n"
+"\t-w <weight> Weight in the trace header (default 1)\n"
+"\t-o <file>   Trace to write\n"
+"\t-v          Print the model and what was generated\n"
+"\t-h          Print this message\n");
+}
+
+static void bad_option(const char *what, const char *arg)
+{
+    fprintf(stderr, "tracegen: bad %s: %s\n", what, arg);
+    exit(1);
+}
+
+/*
+ * parse_sizes - set the model's size distribution from spec
+ */
+static void parse_sizes(model_t *m, const char *spec)
+{
+    const char *pos;
+    char *end;
+    double total = 0, weight;
+    int i;
+
+    if (sscanf(spec, "power:%lf,%lf,%lf", &m->size_a, &m->size_b,
+               &m->size_c) == 3) {
+        if (m->size_a < 1 || m->size_b < m->size_a)
+            bad_option("size range", spec);
+        m->size_kind = SIZE_POWER;
+        return;
+    }
+    if (sscanf(spec, "bimodal:%lf,%lf,%lf", &m->size_a, &m->size_b,
+               &m->size_c) == 3) {
+        if (m->size_a < 1 || m->size_b < 1 || m->size_c < 0 || m->size_c > 1)
+            bad_option("bimodal sizes", spec);
+        m->size_kind = SIZE_BIMODAL;
+        return;
+    }
+    if (strncmp(spec, "set:", 4) != 0)
+        bad_option("size distribution", spec);
+
+    free(m->set_sizes);
+    free(m->set_weights);
+    m->set_sizes = must_alloc(MAX_SET * sizeof(uint64_t));
+    m->set_weights = must_alloc(MAX_SET * sizeof(double));
+    m->set_count = 0;
+    for (pos = spec + 4; *pos != '\0'; pos = *end == ',' ? end + 1 : end) {
+        if (m->set_count == MAX_SET)
+            bad_option("size set, too many sizes", spec);
+        m->set_sizes[m->set_count] = strtoull(pos, &end, 10);
+        weight = 1;
+        if (*end == 'x')
+            weight = strtod(end + 1, &end);
+        if (m->set_sizes[m->set_count] == 0 || weight <= 0
+            || (*end != ',' && *end != '\0'))
+            bad_option("size set", spec);
+        total += weight;
+        m->set_weights[m->set_count++] = total;
+    }
+    if (m->set_count == 0)
+        bad_option("size set", spec);
+    for (i = 0; i < m->set_count; i++)
+        m->set_weights[i] /= total;
+    m->size_kind = SIZE_SET;
+}
+
+/*
+ * parse_lives - set the shape of the model's lifetimes from spec
+ */
+static void parse_lives(model_t *m, const char *spec)
+{
+    if (strcmp(spec, "exp") == 0)
+        m->life_kind = LIFE_EXP;
+    else if (strcmp(spec, "uniform") == 0)
+        m->life_kind = LIFE_UNIFORM;
+    else if (sscanf(spec, "power:%lf", &m->life_alpha) == 1
+             && m->life_alpha > 1)
+        m->life_kind = LIFE_POWER;
+    else
+        bad_option("lifetime shape (power needs alpha above 1)", spec);
+}
+
+static void print_model(const model_t *m)
+{
+    static const char *lives[] = { "exp", "power", "uniform", "fitted" };
+
+    fprintf(stderr, "tracegen: %llu requests, %llu live blocks, weight %d\n",
+            (unsigned long long) m->num_ops, (unsigned long long) m->live,
+            m->weight);
+    if (m->size_kind == SIZE_POWER)
+        fprintf(stderr, "tracegen: sizes power:%g,%g,%g\n", m->size_a,
+                m->size_b, m->size_c);
+    else if (m->size_kind == SIZE_BIMODAL)
+        fprintf(stderr, "tracegen: sizes bimodal:%g,%g,%g\n", m->size_a,
+                m->size_b, m->size_c);
+    else
+        fprintf(stderr, "tracegen: sizes from a set of %d, %llu to %llu\n",
+                m->set_count, (unsigned long long) m->set_sizes[0],
+                (unsigned long long) m->set_sizes[m->set_count - 1]);
+    fprintf(stderr, "tracegen: lifetimes %s", lives[m->life_kind]);
+    if (m->life_kind == LIFE_POWER)
+        fprintf(stderr, ":%g", m->life_alpha);
+    else if (m->life_kind == LIFE_FITTED)
+        fprintf(stderr, " (%zu seen, mean %.0f requests)", m->num_fitted,
+                m->fitted_mean);
+    fprintf(stderr, "\ntracegen: %.3f of blocks grown by %d reallocs of %.3f\n",
+            m->chain_share, m->chain_steps, m->chain_factor);
+}
+
+int main(int argc, char **argv)
+{
+    model_t m;
+    FILE *out;
+    const char *fit_name = NULL, *out_name = NULL;
+    const char *sizes = NULL, *lives = NULL, *chains = NULL;
+    long long ops = -1, live = -1, weight = -1;
+    double scale = 1;
+    int c;
+
+    memset(&m, 0, sizeof(m));
+    rng_state = 1;
+    while ((c = getopt(argc, argv, "d:f:l:n:o:r:s:t:w:x:hv")) != EOF) {
+        switch (c) {
+        case 'd': /* Size distribution */
+            sizes = optarg;
+            break;
+        case 'f': /* Fit the model to a trace */
+            fit_name = optarg;
+            break;
+        case 'l':
+            live = atoll(optarg);
+            break;
+        case 'n':
+            ops = atoll(optarg);
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'r': /* Realloc chains */
+            chains = optarg;
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0);
+            break;
+        case 't': /* Shape of the lifetimes */
+            lives = optarg;
+            break;
+        case 'w':
+            weight = atoll(optarg);
+            break;
+        case 'x': /* Scale the requests and the live set */
+            scale = atof(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (out_name == NULL || optind != argc) {
+        usage();
+        exit(1);
+    }
+
+    /* The model: fitted or the defaults, and then the options */
+    if (fit_name != NULL) {
+        fit(&m, fit_name);
+    } else {
+        parse_sizes(&m, "power:8,4096,1.5");
+        m.life_kind = LIFE_EXP;
+        m.chain_factor = 1;
+        m.live = 1000;
+        m.num_ops = 100000;
+        m.weight = 1;
+    }
+    if (sizes != NULL)
+        parse_sizes(&m, sizes);
+    if (lives != NULL)
+        parse_lives(&m, lives);
+    if (chains != NULL
+        && (sscanf(chains, "%lf,%d,%lf", &m.chain_share, &m.chain_steps,
+                   &m.chain_factor) != 3
+            || m.chain_share < 0 || m.chain_share > 1 || m.chain_steps < 0
+            || m.chain_factor <= 0))
+        bad_option("realloc chains", chains);
+    if (ops >= 0)
+        m.num_ops = ops;
+    if (live >= 0)
+        m.live = live;
+    if (weight >= 0)
+        m.weight = weight;
+    if (m.weight > 3)
+        bad_option("weight, not in {0, 1, 2, 3}", argv[0]);
+    if (scale <= 0)
+        bad_option("scale", argv[0]);
+    m.num_ops = m.num_ops * scale + 0.5;
+    m.live = m.live * scale + 0.5;
+    if (verbose)
+        print_model(&m);
+
+    if ((out = fopen(out_name, "w")) == NULL) {
+        perror(out_name);
+        exit(1);
+    }
+    generate(&m, out);
+    if (fclose(out) != 0) {
+        perror(out_name);
+        exit(1);
+    }
+    return 0;
+}